@@ -21,22 +21,28 @@
 	return *this;
 }*/
 
-std::vector<std::string> Bank::tokenize(std::string str)
+std::vector<uint32_t> Bank::tokenize(const std::string &str)
 {
-	std::vector<std::string> ret{};
-	while (str != "")
+	std::vector<uint32_t> ret{};
+	util::utf8_iter iter{str};
+	while (iter.skip_ascii(), ! iter.done())
 	{
-		std::string ch = util::utf8_popchar(str);
-		int64_t c = util::utf8_codepoint(ch);
-		if ((c >= 0x4E00 && c < 0xA000) || (c >= 0x3400 && c < 0x4DC0) || (c >= 0x20000 && c < 0x2A6E0) || (c >= 0x2A700 && c < 0x2B740) || (c > 0x2B740 && c < 0x2B820) || (c > 0xF900 && c < 0xFB00) || (c > 0x2E80 && c < 0x2FE0) || (c > 0x3000 && c < 0x3040) || (c > 0xF900 && c < 0xFB00) || (c > 0x2F800 && c < 0x2FA20) || (c > 0xFE30 && c < 0xFE50))
-			ret.push_back(ch);
+		uint32_t c = iter.next();
+		if (util::cjk(c)) ret.push_back(c);
 	}
 	return ret;
 }
 
-int Bank::BankItem::offset() const
+uint32_t Bank::codepoint(const std::string &word)
+{
+	util::utf8_iter iter{word};
+	if (iter.done()) throw std::runtime_error{"Empty bank word"};
+	return iter.next();
+}
+
+int Bank::BankItem::offset(int epoch) const
 {
-	return step - Deck::curstep;
+	return step + epoch - Deck::curstep;
 }
 
 Bank &Bank::inherited() const
@@ -44,6 +50,18 @@ Bank &Bank::inherited() const
 	return deck_->inherited()->bank();
 }
 
+int Bank::epoch() const
+{
+	return inherited().deck_->epoch();
+}
+
+Bank::BankItem *Bank::find(uint32_t c)
+{
+	if ((c >> 8) >= words_.size() || words_[c >> 8].empty()) return nullptr;
+	BankItem &bi = words_[c >> 8][c & 0xFF];
+	return bi.enabled ? &bi : nullptr;
+}
+
 Bank::Section &Bank::sect(std::string name)
 {
 	if (! deck_->explic()) return inherited().sect(name);
@@ -53,92 +71,167 @@ Bank::Section &Bank::sect(std::string name)
 	return basis_.back();
 }
 
-bool Bank::check(Card *card) // True if the card should go in kanji, preventing multiple cards with the same kanji from being placed in the same set // <-- This doesn't work because duplicate kanji are detected at the leaf decks, and higher-level decks are the sum of the child decks.  Disabled.
+util::cpset Bank::known(int diff) const
+{
+	util::cpset ret{};
+	const std::vector<std::vector<BankItem>> &words = inherited().words_;
+	int epoch = this->epoch();
+	for (uint32_t page = 0; page < words.size(); page++) for (uint32_t i = 0; i < words[page].size(); i++)
+		if (words[page][i].enabled && words[page][i].offset(epoch) <= diff) ret.insert((page << 8) | i);
+	return ret;
+}
+
+bool Bank::covers(const Card *card, const util::cpset &known) const // True if every kanji in the card is known
 {
-	if (! words().size()) return false;
-	const std::vector<std::string> cardwords = tokenize(card->field(field_));
+	const std::vector<uint32_t> &cardwords = card->kanji();
 	if (! cardwords.size()) return false;
-	//for (const std::string &word : cardwords) if (! words().count(word) || inset_.count(word) || words().at(word).offset() > 0) return false;
-	for (const std::string &word : cardwords) if (! words().count(word) || words().at(word).offset() > 0) return false;
-	for (const std::string &word : cardwords) inset_.insert(word);
+	for (uint32_t c : cardwords) if (! known.count(c)) return false;
 	return true;
 }
 
-bool Bank::enable(std::string word, int step, unsigned int n, bool fromdb)
+bool Bank::check(const Card *card, const util::cpset &known, util::cpset &inset) const // True if the card should go in kanji, preventing multiple cards with the same kanji from being placed in the same set // <-- This doesn't work because duplicate kanji are detected at the leaf decks, and higher-level decks are the sum of the child decks.  Disabled.
 {
-	if (step == -1) step = Deck::curstep;
-	if (words().count(word)) return false;
-	words().insert(std::make_pair(word, BankItem(step, n)));
-	
-	if (! fromdb) backend::bank_edit(*(inherited().deck_), word, 1, step, n);
+	const std::vector<uint32_t> &cardwords = card->kanji();
+	if (! cardwords.size()) return false;
+	for (uint32_t c : cardwords) if (! known.count(c)) return false;
+	for (uint32_t c : cardwords) inset.insert(c);
 	return true;
 }
 
-bool Bank::disable(std::string word)
+void Bank::index(Card *card)
 {
-	if (! words().count(word)) return false;
-	words().erase(word);
-	backend::bank_edit(*(inherited().deck_), word, 0, 0, 0);
-	return true;
+	Bank &bank = inherited();
+	for (uint32_t c : card->kanji()) bank.index_[c].insert(card);
 }
 
-bool Bank::enabled(std::string word) const
+void Bank::unindex(Card *card)
 {
-	return words().count(word) > 0;
+	Bank &bank = inherited();
+	for (uint32_t c : card->kanji())
+	{
+		std::unordered_map<uint32_t, std::unordered_set<Card *>>::iterator iter = bank.index_.find(c);
+		if (iter == bank.index_.end()) continue;
+		iter->second.erase(card);
+		if (iter->second.empty()) bank.index_.erase(iter);
+	}
 }
 
-void Bank::update(Card *card, Card::UpdateType type) // TODO offset
+void Bank::retally(const std::vector<uint32_t> &changed) // Move just the cards containing these kanji between the kanji and kana sets instead of rebuilding
 {
-	if (! card->due(0)) for (const std::string &word : tokenize(card->field(field_)))
+	std::unordered_set<Card *> cards{};
+	for (uint32_t c : changed)
 	{
-		if (words().count(word))
-		{
-			BankItem &bi = words().at(word);
-			bi.step = Deck::curstep + 1;
-			bi.practices++;
-			// assert(inset_.count(word));
-			if (inset_.count(word)) inset_.erase(inset_.find(word));
-			backend::bank_edit(*(inherited().deck_), word, 1, bi.step, bi.practices);
-		}
+		std::unordered_map<uint32_t, std::unordered_set<Card *>>::const_iterator iter = index_.find(c);
+		if (iter != index_.end()) cards.insert(iter->second.begin(), iter->second.end());
 	}
+	if (cards.empty()) return;
+	const util::cpset known = this->known();
+	for (Card *card : cards) card->deck()->regroup(*card, known);
 }
 
-void Bank::commit(std::string olddeck) const
+void Bank::field(std::string f)
 {
-	backend::transac_begin();
-	for (const Section &s : inherited().basis_) for (const std::string &word : s.words)
+	Deck::invalidate();
+	field_ = f;
+	if (deck_) for (Card *c : deck_->cards())
 	{
-		if (words().count(word))
-		{
-			const BankItem &bi = words().at(word);
-			backend::bank_edit(*(inherited().deck_), word, 1, bi.step, bi.practices, olddeck);
-		}
-		else backend::bank_edit(*(inherited().deck_), word, 0, 0, 0, olddeck);
+		unindex(c);
+		c->cache(*deck_);
+		index(c);
 	}
-	backend::transac_end();
 }
 
-void Bank::shift(int diff)
+bool Bank::enable(std::string word, int step, unsigned int n, bool fromdb)
 {
-	for (std::pair<const std::string, BankItem> &word : words())
+	Deck::invalidate();
+	Bank &bank = inherited();
+	if (step == -1) step = Deck::curstep - bank.epoch();
+	uint32_t c = codepoint(word);
+	if (bank.find(c)) return false;
+	if ((c >> 8) >= bank.words_.size()) bank.words_.resize((c >> 8) + 1);
+	if (bank.words_[c >> 8].empty()) bank.words_[c >> 8].resize(256);
+	bank.words_[c >> 8][c & 0xFF] = BankItem(step, n);
+	bank.nwords_++;
+	
+	if (! fromdb)
 	{
-		word.second.step += diff;
-		backend::bank_edit(*(inherited().deck_), word.first, 1, word.second.step, word.second.practices);
+		Notify::Batch batch{};
+		backend::bank_edit(*bank.deck_, word, 1, step, n);
+		bank.retally({c});
+		Notify::bank();
 	}
+	return true;
 }
 
-std::vector<std::string> Bank::vectorize(std::string word, const std::vector<coldesc> &colspec) const
+bool Bank::disable(std::string word)
 {
-	std::vector<std::string> ret{};
-	for (coldesc col : colspec)
+	Deck::invalidate();
+	Bank &bank = inherited();
+	uint32_t c = codepoint(word);
+	BankItem *bi = bank.find(c);
+	if (! bi) return false;
+	*bi = BankItem{};
+	bank.nwords_--;
+	Notify::Batch batch{};
+	backend::bank_edit(*bank.deck_, word, 0, 0, 0);
+	bank.retally({c});
+	Notify::bank();
+	return true;
+}
+
+bool Bank::enabled(std::string word) const
+{
+	return inherited().find(codepoint(word)) != nullptr;
+}
+
+void Bank::update(Card *card, Card::UpdateType type) // TODO offset
+{
+	Deck::invalidate();
+	Bank &bank = inherited();
+	if (! card->due(0)) for (uint32_t c : card->kanji())
 	{
-		if (col.title == "Deck") ret.push_back(inherited().deck_->canonical());
-		else if (col.title == "Word") ret.push_back(word);
-		else if (col.title == "Offset") ret.push_back(util::t2s(words().at(word).offset()));
-		else if (col.title == "Practices") ret.push_back(util::t2s<int>(words().at(word).practices));
-		else ret.push_back("NULL");
+		BankItem *bi = bank.find(c);
+		if (bi)
+		{
+			bi->step = Deck::curstep + 1 - bank.epoch();
+			bi->practices++;
+			inset_.erase(c);
+			backend::bank_edit(*bank.deck_, util::utf8_encode(c), 1, bi->step, bi->practices);
+			Notify::bank();
+		}
 	}
-	return ret;
+}
+
+void Bank::section(const std::string &name, bool enable)
+{
+	Deck::invalidate();
+	Bank &bank = inherited();
+	std::list<Section>::const_iterator s = std::find_if(bank.basis_.begin(), bank.basis_.end(), [&name](const Section &section) { return section.name == name; });
+	if (s == bank.basis_.end()) throw std::runtime_error{"No bank section named " + name};
+	int step = Deck::curstep - bank.epoch();
+	std::vector<uint32_t> changed{};
+	for (const std::string &word : s->words)
+	{
+		uint32_t c = codepoint(word);
+		if ((bank.find(c) != nullptr) == enable) continue;
+		if (enable)
+		{
+			if ((c >> 8) >= bank.words_.size()) bank.words_.resize((c >> 8) + 1);
+			if (bank.words_[c >> 8].empty()) bank.words_[c >> 8].resize(256);
+			bank.words_[c >> 8][c & 0xFF] = BankItem(step, 0);
+			bank.nwords_++;
+		}
+		else
+		{
+			*bank.find(c) = BankItem{};
+			bank.nwords_--;
+		}
+		changed.push_back(c);
+	}
+	backend::bank_section(*bank.deck_, name, enable, step);
+	Notify::Batch batch{};
+	bank.retally(changed);
+	Notify::bank();
 }
 
 /*std::vector<std::string> Bank::wordlist() const
@@ -148,15 +241,15 @@ std::vector<std::string> Bank::vectorize(std::string word, const std::vector<col
 	return ret;
 }*/
 
-std::string Bank::htmlview() const
+std::vector<std::pair<std::string, std::vector<uint32_t>>> Bank::sections() const
 {
-	std::stringstream ret{};
-	ret << "<html><body>";
+	std::vector<std::pair<std::string, std::vector<uint32_t>>> ret{};
 	for (const Section &section : inherited().basis_)
 	{
-		ret << "<h3>" << section.name << "</h3>";
-		for (const std::string &word : section.words) ret << "<bankbtn name=\"" << word << "\">"; // "<font color=" << (words_.count(word) ? "black" : "gray") << "><a href=\"" << word << "\">" << word << "</a></font>&nbsp;"
+		std::vector<uint32_t> words{};
+		for (const std::string &word : section.words) words.push_back(codepoint(word));
+		std::sort(words.begin(), words.end());
+		ret.push_back(std::make_pair(section.name, std::move(words)));
 	}
-	ret << "</html></body>";
-	return ret.str();
+	return ret;
 }
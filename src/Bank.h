@@ -18,14 +18,17 @@ class Deck;
 
 class Bank
 {
-private:
+public:
 	struct BankItem
 	{
 		int step;
 		unsigned int practices;
-		BankItem(int s, unsigned int p) : step{s}, practices{p} { }
-		int offset() const;
+		bool enabled;
+		BankItem() : BankItem{0, 0} { enabled = false; }
+		BankItem(int s, unsigned int p) : step{s}, practices{p}, enabled{true} { }
+		int offset(int epoch) const; // Steps until due, given the epoch of the bank's deck
 	};
+private:
 	struct Section
 	{
 		std::string name;
@@ -34,41 +37,51 @@ private:
 		void add(std::string word) { words.insert(word); }
 		void del(std::string word) { if (words.count(word)) words.erase(words.find(word)); }
 	};
-	static std::vector<std::string> tokenize(std::string str);
+	static uint32_t codepoint(const std::string &word);
 	
-	std::unordered_map<std::string, BankItem> words_;
-	std::unordered_set<std::string> inset_;
+	std::vector<std::vector<BankItem>> words_; // Indexed by codepoint, a 256-codepoint page at a time; pages are allocated when first written
+	int nwords_;
+	util::cpset inset_;
 	std::string field_;
 	Deck *deck_;
 	std::list<Section> basis_;
+	std::unordered_map<uint32_t, std::unordered_set<Card *>> index_; // Cards containing each kanji, kept only in explicit decks' banks
 	Section &sect(std::string name);
 	Bank &inherited() const;
-	std::unordered_map<std::string, BankItem> &words() const { return inherited().words_; }
+	BankItem *find(uint32_t c); // The enabled item for the codepoint in this bank's own table, or null
+	const BankItem *find(uint32_t c) const { return const_cast<Bank *>(this)->find(c); }
+	void retally(const std::vector<uint32_t> &changed);
 public:
+	static std::vector<uint32_t> tokenize(const std::string &str); // Codepoints of the kanji in the string
 	void addsect(std::string name) { sect(name); }
 	void add(std::string section, std::string word) { sect(section).add(word); }
 	void del(std::string word) { for (Section &section : basis_) section.del(word); }
 	Bank() : Bank{nullptr, ""} { }
-	Bank(Deck *deck, std::string field) : words_{}, inset_{}, field_{field}, deck_{deck}, basis_{} { }
+	Bank(Deck *deck, std::string field) : words_{}, nwords_{0}, inset_{}, field_{field}, deck_{deck}, basis_{}, index_{} { }
 	Bank(const Bank& orig) = default;
 	Bank &operator =(const Bank& orig) = default;
 	virtual ~Bank() { }
 	
-	int size() const { return words().size(); }
+	int size() const { return inherited().nwords_; }
 	Deck *deck() const { return deck_; }
+	const std::string &field() const { return field_; }
 	bool enabled(std::string word) const;
-	std::vector<std::string> vectorize(std::string word, const std::vector<coldesc> &colspec) const;
 	//std::vector<std::string> wordlist() const;
-	std::string htmlview() const;
-	void commit(std::string olddeck = "") const;
-	bool check(Card *card);
+	std::vector<std::pair<std::string, std::vector<uint32_t>>> sections() const; // Each section's name and kanji, in codepoint order
+	const BankItem *item(uint32_t c) const { return inherited().find(c); } // Null if the kanji is not enabled
+	int epoch() const;
+	util::cpset known(int diff = 0) const; // Enabled kanji that are not scheduled past diff steps from now
+	bool covers(const Card *card, const util::cpset &known) const;
+	bool check(const Card *card, const util::cpset &known, util::cpset &inset) const;
 	
 	void deck(Deck *d) { deck_ = d; }
-	void field(std::string f) { field_ = f; }
+	void field(std::string f);
 	bool enable(std::string word, int step = -1, unsigned int n = 0, bool fromdb = false);
 	bool disable(std::string word);
-	void shift(int diff);
-	void clear() { inset_.clear(); }
+	void section(const std::string &name, bool enable); // Enable or disable every kanji in a section at once
+	void index(Card *card); // Record the card's kanji() in the inherited bank's index
+	void unindex(Card *card); // Undo index(); call before the card's kanji() or deck changes
+	void inset(util::cpset &&words) { inset_ = std::move(words); }
 	void update(Card *card, Card::UpdateType type);
 };
 
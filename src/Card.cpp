@@ -15,6 +15,7 @@ const double Card::ratio_ = 2;
 const int Card::maxdelay_ = 365;
 std::list<Card> Card::cards_{};
 int Card::cardnum_ = 1;
+Search Card::search_{};
 
 std::string Card::stat2str(Status status)
 {
@@ -64,148 +65,187 @@ Card::Field Card::str2sit(std::string str)
 	throw std::runtime_error{"Invalid set item type string \"" + str + "\" passed to str2sit"};
 }
 
-std::string Card::html_furigana(std::string kanji, std::string furigana)
+int Card::fieldid(const std::string &name)
 {
-	int kanjisize = 8;
-	int kanasize = 3;
-	//std::string kanji{kanji_s}, furigana{furigana_s};
-	std::stringstream ret{};
-	ret << "<table cellpadding=0><tr>";
-	while (kanji != "")
+	static std::unordered_map<std::string, int> ids{}; // Local, since decks compile their templates during static initialization
+	return ids.emplace(name, ids.size()).first->second;
+}
+
+void Card::ruby(const std::string &kanji, const std::string &furigana, std::vector<Ruby> &out)
+{
+	util::utf8_iter iter{kanji};
+	std::string_view rest{furigana};
+	while (! iter.done())
 	{
-		std::string kchar = util::utf8_popchar(kanji);
-		std::string kfur = util::strto(furigana, ",");
-		while (kfur.length() > 0 && kfur.at(0) == '.')
-		{
-			kchar += util::utf8_popchar(kanji);
-			kfur = kfur.substr(1);
-		}
-		if (kfur == "") kfur = "&nbsp;";
-		ret << "<td valign=bottom><center><font size=" << kanasize << ">" << kfur << "</font><br><font size=" << kanjisize << ">" << kchar << "</font></center></td>";
+		const char *kstart = iter.pos();
+		iter.next();
+		std::string_view kfur = util::strto(rest, ","); // Each comma-separated group of furigana covers one character
+		std::string_view::size_type dots = 0;
+		for (; dots < kfur.size() && kfur[dots] == '.' && ! iter.done(); dots++) iter.next(); // Each leading dot extends the group over another character
+		while (dots < kfur.size() && kfur[dots] == '.') dots++;
+		out.push_back(Ruby{std::string{kstart, iter.pos()}, std::string{kfur.substr(dots)}});
 	}
-	ret << "</tr></table>";
-	return ret.str();
 }
 
-std::string Card::hiragana(std::string kanji, std::string furigana)
+void Card::words(std::string_view text, std::vector<Ruby> &out)
 {
-	//std::string kanji{kanji_s}, furigana{furigana_s};
-	std::stringstream ret{};
-	while (kanji != "")
+	util::utf8_iter iter{text};
+	while (! iter.done())
 	{
-		std::string kchar = util::utf8_popchar(kanji);
-		std::string kfur = util::strto(furigana, ",");
-		while (kfur.length() > 0 && kfur.at(0) == '.')
-		{
-			kchar += util::utf8_popchar(kanji);
-			kfur = kfur.substr(1);
-		}
-		if (kfur == "") ret << kchar;
-		else ret << kfur;
+		const char *start = iter.pos();
+		if (*start == ' ') iter.next();
+		else if (*start & 0x80) iter.next();
+		else while (! iter.done() && *iter.pos() != ' ' && ! (*iter.pos() & 0x80)) iter.next();
+		out.push_back(Ruby{std::string{start, iter.pos()}, ""});
 	}
-	return ret.str();
+}
+
+std::string Card::hiragana(const std::string &kanji, const std::string &furigana)
+{
+	std::string ret{};
+	ret.reserve(kanji.size() + furigana.size());
+	std::vector<Ruby> groups{};
+	ruby(kanji, furigana, groups);
+	for (const Ruby &group : groups) ret.append(group.reading == "" ? group.base : group.reading);
+	return ret;
 }
 
 Card &Card::add(Deck &deck, int id, std::unordered_map<std::string, std::string> fieldlist, int offset, int delay, std::unordered_map<UpdateType, int, uthash> count, Card::Status status, int statinfo, bool fromdb)
 {
 	int step;
 	if (fromdb) step = offset;
-	else step = offset + Deck::curstep;
+	else step = offset + Deck::curstep - deck.epoch();
 	cards_.emplace_back(Card{id, &deck, fieldlist, step, delay, count, status, statinfo});
 	cardnum_ = std::max(id, cardnum_);
 	Card &c = cards_.back();
+	if (! fromdb) // Loading caches everything at once afterward
+	{
+		c.cache(deck);
+		deck.bank().index(&c);
+		search_.add(&c);
+	}
 	deck.addcard(c, ! fromdb);
 	if (! fromdb) backend::card_update(c);
 	if (! fromdb) for (const std::string &field : Card::fieldnames()) backend::card_edit(c, field);
+	if (! fromdb) Notify::added(&c);
 	return c;
 }
 
+void Card::cache_all()
+{
+	std::vector<Card *> all{};
+	for (Card &c : cards_) all.push_back(&c);
+	std::vector<std::string> texts(all.size());
+	util::parallel_for(all.size(), [&all, &texts](std::size_t i)
+	{
+		all[i]->cache(*all[i]->deck_);
+		texts[i] = Search::text(*all[i]);
+	});
+	for (std::size_t i = 0; i < all.size(); i++) // The indices are shared, so fill them serially
+	{
+		all[i]->deck_->bank().index(all[i]);
+		search_.add(all[i], std::move(texts[i]));
+	}
+}
+
+void Card::cache(const Deck &deck)
+{
+	std::unordered_map<std::string, std::string>::const_iterator iter = fields_.find(deck.bank().field());
+	if (iter == fields_.end()) kanji_.clear();
+	else kanji_ = Bank::tokenize(iter->second);
+}
+
 Card &Card::create(Deck &deck)
 {
 	return add(deck, ++cardnum_, {}, 0, 0, {}, Card::Status::OK, 0);
 }
 
-void Card::del(Card &card, bool refresh, bool explic)
+void Card::unlink(bool refresh, bool explic)
 {
-	Deck *deck = card.deck_;
-	deck->delcard(card, refresh);
-	card.deck_ = nullptr; // Prevent infinite loops of deletion!
+	Deck *deck = deck_;
+	if (refresh) deck->bank().unindex(this); // Otherwise the deck is being destroyed, and Deck::del() has already done this
+	deck->delcard(*this, refresh);
+	deck_ = nullptr; // Prevent infinite loops of deletion!
 	for (Deck *cur = deck; cur != &Deck::root; cur = cur->parent())
 	{
 		if (! cur->explic() && ! cur->size() && ! cur->children().size() && ! explic) Deck::del(*cur);
 		else break;
 	}
-	if (backend::db && refresh) backend::card_del(card);
+	if (backend::db && refresh) backend::card_del(*this);
+	search_.del(this);
+	Notify::removed(this);
+}
+
+void Card::del(Card &card, bool refresh, bool explic)
+{
+	card.unlink(refresh, explic);
 	cards_.erase(std::find(cards_.begin(), cards_.end(), card));
 }
 
+void Card::del(const std::vector<Card *> &cards)
+{
+	Watchdog::Phase phase{Watchdog::Part::MODEL};
+	Deck::Batch batch{};
+	std::unordered_set<const Card *> gone{};
+	for (Card *card : cards) if (gone.insert(card).second) card->unlink(true, false);
+	cards_.remove_if([&gone](const Card &card) { return gone.count(&card); }); // One pass rather than a search for each
+}
+
+void Card::edit(const std::vector<Card *> &cards, const std::function<void(Card &)> &change)
+{
+	Watchdog::Phase phase{Watchdog::Part::MODEL};
+	Deck::Batch batch{};
+	for (Card *card : cards) change(*card);
+}
+
 void Card::edit(Deck &deck, int offset, int delay, Status status)
 {
+	Deck::invalidate();
+	Notify::Batch batch{}; // Moving may create and delete decks
 	if (&deck != deck_)
 	{
 		Deck *olddeck = deck_;
 		assert(olddeck->size() > 0);
+		olddeck->bank().unindex(this);
 		olddeck->delcard(*this);
 		deck_ = nullptr;
+		cache(deck);
+		deck.bank().index(this);
+		deck_ = &deck; // Before addcard() builds, since offset() needs the deck
 		deck.addcard(*this);
-		deck_ = &deck;	
 	}
-	step_ = Deck::curstep + offset;
+	step_ = Deck::curstep + offset - deck_->epoch();
 	delay_ = delay;
 	status_ = status;
 	deck_->build();
 	backend::card_update(*this);
+	Notify::updated(this);
 }
 
-std::vector<std::string> Card::vectorize(const std::vector<coldesc> &colspec) const
+void Card::field(std::string name, std::string value)
 {
-	std::vector<std::string> ret{};
-	for (coldesc col : colspec)
+	Deck::invalidate();
+	fields_.at(name) = value;
+	revision_++;
+	if (name == deck_->bank().field())
 	{
-		if (col.title == "Deck") ret.push_back(deck_->canonical());
-		else if (col.title == "Status") ret.push_back(stat2str(status_));
-		else if (col.title == "Offset") ret.push_back(util::t2s(offset()));
-		else if (col.title == "Interval") ret.push_back(util::t2s<int>(delay_));
-		else if (col.title == "Norm") ret.push_back(util::t2s<int>(count_.at(UpdateType::NORM)));
-		else if (col.title == "Incr") ret.push_back(util::t2s<int>(count_.at(UpdateType::INCR)));
-		else if (col.title == "Decr") ret.push_back(util::t2s<int>(count_.at(UpdateType::DECR)));
-		else if (col.title == "Reset") ret.push_back(util::t2s<int>(count_.at(UpdateType::RESET)));
-		else if (std::find(std::begin(fieldnames_), std::end(fieldnames_), col.title) != fieldnames_.end()) ret.push_back(fields_.at(col.title));
-		else ret.push_back("NULL");
+		deck_->bank().unindex(this);
+		cache(*deck_);
+		deck_->bank().index(this);
 	}
-	return ret;
+	search_.update(this);
+	backend::card_edit(*this, name);
+	Notify::updated(this);
 }
 
-std::string Card::display(std::vector<Field> fields) const
+void Card::slot()
 {
-	int kanasize;
-	std::stringstream ret{};
-	for (Field field : fields)
+	for (const std::pair<const std::string, std::string> &field : fields_)
 	{
-		switch (field)
-		{
-			case Field::KANJI:
-				ret << html_furigana(fields_.at("Expression"), "");
-				break;
-			case Field::HIRAGANA:
-				kanasize = (fields.size() == 1) ? 8 : 4;
-				ret << "<font size=" << kanasize << ">";
-				if (fields_.at("Reading") == "") ret << fields_.at("Expression");
-				else ret << hiragana(fields_.at("Expression"), fields_.at("Reading"));
-				ret << "</font>";
-				break;
-			case Field::FURIGANA:
-				ret << html_furigana(fields_.at("Expression"), fields_.at("Reading"));
-				break;
-			case Field::MEANING:
-				ret << "<font size=4><b>" + fields_.at("Meaning") + "</b></font>";
-				break;
-			//case Field::ALL: return html_furigana(fields_.at("Expression"), fields_.at("Reading")) + "<br><br><font size=4><b>" + fields_.at("Meaning") + "</b></font>";
-			case Field::NONE: ret << "";
-		}
-		ret << "<br><br>";
+		std::size_t id = fieldid(field.first);
+		if (id >= slots_.size()) slots_.resize(id + 1, nullptr);
+		slots_[id] = &field.second;
 	}
-	return ret.str();
 }
 
 bool Card::avail() const
@@ -221,46 +261,67 @@ bool Card::due(int diff) const
 	return false;
 }
 
-bool Card::match(std::string query) const
+void Card::project(std::vector<int> &hist, bool reviews) const // Count the steps in the next hist.size() at which this card falls due, optionally assuming each review is answered "increase"
 {
-	if (query == "") return true;
-	for (const std::pair<std::string, std::string> &field : fields_) if (field.second.find(query) != std::string::npos) return true;
-	if (hiragana(fields_.at("Expression"), fields_.at("Reading")).find(query) != std::string::npos) return true;
-	return false;
+	if (! avail()) return;
+	int at = std::max(offset(), 0);
+	int delay = delay_;
+	while (at < static_cast<int>(hist.size()))
+	{
+		hist[at]++;
+		if (! reviews) break;
+		if (delay == 0) delay = 1;
+		else delay *= ratio_;
+		if (delay > maxdelay_) break;
+		at += delay;
+	}
 }
 
-void Card::shift(int diff)
+std::vector<Card *> Card::search(const std::string &query)
 {
-	if (status_ == Status::SUSP) return;
-	step_ += diff;
-	backend::card_update(*this);
+	Watchdog::Phase phase{Watchdog::Part::MODEL};
+	if (query.empty())
+	{
+		std::vector<Card *> ret{};
+		for (Card &c : cards_) ret.push_back(&c);
+		return ret;
+	}
+	return search_.find(query);
+}
+
+void Card::rebase(int diff)
+{
+	Deck::invalidate();
+	step_ -= diff;
+	Notify::updated(this);
 }
 
 void Card::update(UpdateType type)
 {
 	// TODO Leeching (or eliminate -- will require adding a field)
+	Deck::invalidate();
 	switch (type)
 	{
 		case UpdateType::NONE:
 		case UpdateType::BURY:
 			break;
 		case UpdateType::NORM:
-			step_ = Deck::curstep + delay_;
+			step_ = Deck::curstep - deck_->epoch() + delay_;
 			break;
 		case UpdateType::INCR:
 			if (delay_ == 0) delay_ = 1;
 			else delay_ *= ratio_;
-			step_ = Deck::curstep + delay_;
+			step_ = Deck::curstep - deck_->epoch() + delay_;
 			if (delay_ > maxdelay_) status_ = Status::DONE;
 			break;
 		case UpdateType::DECR:
 			delay_ /= ratio_;
-			step_ = Deck::curstep + delay_;
+			step_ = Deck::curstep - deck_->epoch() + delay_;
 			break;
 		case UpdateType::RESET:
 			status_ = Status::OK;
 			delay_ = 0;
-			step_ = Deck::curstep;
+			step_ = Deck::curstep - deck_->epoch();
 			break;
 		case UpdateType::DONE:
 			status_ = Status::DONE;
@@ -277,9 +338,10 @@ void Card::update(UpdateType type)
 	}
 	count_[type]++;
 	backend::card_update(*this);
+	Notify::updated(this);
 }
 
 int Card::offset() const
 {
-	return step_ - Deck::curstep;
+	return step_ + deck_->epoch() - Deck::curstep;
 }
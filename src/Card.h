@@ -10,16 +10,19 @@
 
 #include <unordered_map>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <vector>
 #include <list>
 #include <algorithm>
+#include <functional>
 #include <stdexcept>
 #include <iostream> // TODO Debug remove
 #include <cassert>
 #include "util.h"
 #include "coldesc.h"
 #include "backend.h"
+#include "Search.h"
 
 class Deck;
 
@@ -35,11 +38,22 @@ private:
 	static const double ratio_;
 	static const int maxdelay_;
 	static int cardnum_;
+	static Search search_;
 public:
 	enum class Status { OK = 1, SUSP = 2, DONE = 3, LEECH = 4 };
 	enum class UpdateType { NONE, INCR, DECR, NORM, RESET, SUSP, LEECH, BURY, RESUME, DONE };
 	enum class Field { NONE, KANJI, HIRAGANA, FURIGANA, MEANING };
 	struct uthash { size_t operator ()(const UpdateType &x) const { return static_cast<size_t>(x); } };
+	struct Ruby // A piece of text that can't be broken across lines, with the furigana over it if any
+	{
+		std::string base;
+		std::string reading;
+	};
+	struct Block // One line of a card as shown for study
+	{
+		Field field; // Which kind of field it shows, for choosing how to draw it
+		std::vector<Ruby> runs;
+	};
 
 	static std::vector<std::string> fieldnames() { return fieldnames_; }
 	static int maxdelay() { return maxdelay_; }
@@ -48,12 +62,19 @@ public:
 	static std::string sit2str(Field sit);
 	static std::string sits2str(std::vector<Field> sits);
 	static Field str2sit(std::string str);
-	static std::string html_furigana(std::string kanji, std::string furigana);
-	static std::string hiragana(std::string kanji, std::string furigana);
+	static int fieldid(const std::string &name); // Small number standing for a field name, for looking fields up in slots() without hashing
+	static std::string hiragana(const std::string &kanji, const std::string &furigana);
+	static void ruby(const std::string &kanji, const std::string &furigana, std::vector<Ruby> &out); // Append the expression in the groups of characters its furigana cover
+	static void words(std::string_view text, std::vector<Ruby> &out); // Append the text in pieces that lines may break between
 	static Card &add(Deck &deck, int id = ++cardnum_, std::unordered_map<std::string, std::string> fieldlist = deffields_, int offset = 0, int delay = 1, std::unordered_map<UpdateType, int, uthash> count = {{UpdateType::NORM, 0}, {UpdateType::INCR, 0}, {UpdateType::DECR, 0}, {UpdateType::RESET, 0}}, Status status = Status::OK, int statinfo = 0, bool fromdb = false);
 	static Card &create(Deck &deck);
 	static std::list<Card> &cards() { return cards_; }
 	static void del(Card &card, bool refresh = true, bool explic = false);
+	static void del(const std::vector<Card *> &cards); // All at once, as edit() does below
+	static void edit(const std::vector<Card *> &cards, const std::function<void(Card &)> &change); // Apply change to each card with one transaction, one build of each deck involved and one view update
+	static void cache_all(); // Recompute every card's cached kanji and search text, in parallel; for use after loading
+	static std::vector<Card *> search(const std::string &query); // Cards matching the query by Search::find(), or all of them
+	static const Search &index() { return search_; }
 private:
 	int id_;
 	Deck *deck_;
@@ -62,32 +83,41 @@ private:
 	std::unordered_map<UpdateType, int, uthash> count_;
 	Status status_;
 	std::unordered_map<std::string, std::string> fields_;
-	Card(int id, Deck *deck, std::unordered_map<std::string, std::string> fieldlist, int step, int delay, std::unordered_map<UpdateType, int, uthash> count, Status status, int statinfo) : id_{id}, deck_{deck}, step_{step}, delay_{delay}, count_{count}, status_{status}, fields_{fieldlist} { }
+	std::vector<uint32_t> kanji_; // Bank codepoints in the field the deck's bank reads, so builds need not decode it
+	int revision_; // Bumped whenever a field changes, so anything rendered from the fields can tell it is stale
+	std::vector<const std::string *> slots_; // Values in fields_ by fieldid(), or null where the card lacks the field
+	Card(int id, Deck *deck, std::unordered_map<std::string, std::string> fieldlist, int step, int delay, std::unordered_map<UpdateType, int, uthash> count, Status status, int statinfo) : id_{id}, deck_{deck}, step_{step}, delay_{delay}, count_{count}, status_{status}, fields_{fieldlist}, kanji_{}, revision_{0}, slots_{} { slot(); }
+	void slot(); // Fill slots_ from fields_
+	void unlink(bool refresh, bool explic); // All of del() but taking the card out of cards_
 public:
 	Card() = delete;
 	Card(const Card &orig) = delete;
-	Card(const Card&& orig) : id_{orig.id_}, deck_{orig.deck_}, step_{orig.step_}, delay_{orig.delay_}, count_{std::move(orig.count_)}, status_{orig.status_}, fields_{std::move(orig.fields_)} { }
+	Card(const Card&& orig) : id_{orig.id_}, deck_{orig.deck_}, step_{orig.step_}, delay_{orig.delay_}, count_{std::move(orig.count_)}, status_{orig.status_}, fields_{std::move(orig.fields_)}, kanji_{std::move(orig.kanji_)}, revision_{orig.revision_}, slots_{} { slot(); } // orig is const, so fields_ is a copy
 	Card operator =(const Card& orig) = delete;
 	virtual ~Card() { }
 	
-	std::string field(std::string name) const { return fields_.at(name); }
+	const std::string &field(const std::string &name) const { return fields_.at(name); }
+	const std::unordered_map<std::string, std::string> &fields() const { return fields_; }
+	const std::vector<const std::string *> &slots() const { return slots_; }
 	int id() const { return id_; }
+	int revision() const { return revision_; }
 	int delay() const { return delay_; }
 	Deck *deck() const { return deck_; }
-	std::vector<std::string> vectorize(const std::vector<coldesc> &colspec) const;
-	std::string display(std::vector<Field> fields) const;
 	bool hasfield(std::string name) const { return fields_.count(name); }
+	const std::vector<uint32_t> &kanji() const { return kanji_; }
 	int offset() const;
 	std::unordered_map<UpdateType, int, uthash> count() const { return count_; }
-	int step() const { return step_; }
+	int count(UpdateType type) const { std::unordered_map<UpdateType, int, uthash>::const_iterator iter = count_.find(type); return iter == count_.end() ? 0 : iter->second; }
+	int step() const { return step_; } // Relative to the deck's epoch
 	Status status() const { return status_; }
-	bool match(std::string query) const;
 	bool avail() const;
 	bool due(int diff = 0) const;
+	void project(std::vector<int> &hist, bool reviews) const;
 	
-	void shift(int diff);
+	void rebase(int diff); // Keep the schedule when the deck's epoch moves by diff
 	void edit(Deck &deck, int offset, int delay, Status status);
-	void field(std::string name, std::string value) { fields_.at(name) = value; backend::card_edit(*this, name); }
+	void field(std::string name, std::string value);
+	void cache(const Deck &deck); // Recompute kanji() from the field that deck's bank reads
 	void update(UpdateType type);
 	friend bool operator ==(const Card &a, const Card &b) { return a.id_ == b.id_; }
 };
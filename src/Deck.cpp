@@ -7,44 +7,125 @@
 
 #include "Deck.h"
 
+std::thread Deck::speculator_{}; // Defined before decks_ so that it outlives them during static destruction
+std::atomic<bool> Deck::speculated_{false}, Deck::cancel_{false};
+std::unique_ptr<Deck::Generation> Deck::shadow_{};
+std::chrono::steady_clock::time_point Deck::changed_{};
+int Deck::batch_ = 0;
+std::unordered_set<Deck *> Deck::stale_{}; // Also before decks_, which erase themselves from it when destroyed
 std::list<Deck> Deck::decks_{};
 int Deck::curstep = 0;
+unsigned int Deck::seed_ = std::chrono::system_clock::now().time_since_epoch().count(); // Must be initialized before root
 Deck Deck::root{-1, "", true, nullptr}; // TODO Use the SetItemTypes here to set default set types.  Make a static function: set_default(sit, sit)...
 int Deck::decknum_ = 1;
-std::default_random_engine Deck::rand_{(long unsigned int) std::chrono::system_clock::now().time_since_epoch().count()};
+
+Deck::Batch::Batch() : notify_{}, transac_{backend::db != nullptr}
+{
+	if (transac_) backend::transac_begin();
+	batch_++;
+}
+
+Deck::Batch::~Batch() noexcept(false)
+{
+	std::exception_ptr error{};
+	if (--batch_ == 0)
+	{
+		std::unordered_set<Deck *> stale{};
+		std::swap(stale, stale_);
+		try { for (Deck *d : stale) d->build(); }
+		catch (...) { error = std::current_exception(); }
+	}
+	try { if (transac_) backend::transac_end(); } // Commit what was done even if a build failed
+	catch (...) { if (! error) error = std::current_exception(); }
+	if (error && ! std::uncaught_exceptions()) std::rethrow_exception(error); // Otherwise already unwinding from the error that matters
+}
 
 void Deck::step(int offset)
 {
 	if (offset == 0) return;
+	Watchdog::Phase phase{Watchdog::Part::MODEL};
+	Notify::Batch batch{};
+	if (speculator_.joinable()) speculator_.join();
+	std::unique_ptr<Generation> shadow = std::move(shadow_);
 	curstep += offset;
 	backend::step(offset);
-	for (Deck &d : decks_) d.build();
+	if (shadow && shadow->step == curstep) for (std::pair<Deck *, Staged> &pair : shadow->decks) pair.first->publish(std::move(pair.second));
+	else rebuild_all();
+	Notify::all();
+}
+
+void Deck::rebuild_all()
+{
+	Watchdog::Phase phase{Watchdog::Part::MODEL};
+	invalidate();
+	Notify::Batch batch{};
+	std::vector<std::pair<Deck *, Staged>> all{};
+	for (Deck &d : decks_) all.push_back(std::make_pair(&d, d.snapshot()));
+	util::parallel_for(all.size(), [&all](std::size_t i) { all[i].first->prepare(all[i].second); });
+	for (std::pair<Deck *, Staged> &pair : all) pair.first->publish(std::move(pair.second));
+}
+
+void Deck::speculate()
+{
+	if (speculator_.joinable())
+	{
+		if (! speculated_) return;
+		speculator_.join();
+	}
+	if (shadow_ || decks_.empty() || std::chrono::steady_clock::now() - changed_ < quiet_) return;
+	Watchdog::Phase phase{Watchdog::Part::MODEL};
+	std::unique_ptr<Generation> gen{new Generation{curstep + 1, {}}};
+	for (Deck &d : decks_) gen->decks.push_back(std::make_pair(&d, d.snapshot()));
+	speculated_ = false;
+	speculator_ = std::thread{[](Generation *gen)
+	{
+		std::unique_ptr<Generation> owned{gen};
+		try { for (std::pair<Deck *, Staged> &pair : owned->decks) if (! cancel_) pair.first->prepare(pair.second, 1); }
+		catch (std::exception &e) { owned->step = -1; owned->decks.clear(); } // Don't retry; the real build at step time will report the error
+		if (! cancel_) shadow_ = std::move(owned);
+		speculated_ = true;
+	}, gen.release()};
 }
 
-Deck::Deck(int id, std::string name, bool explic, Deck *parent) : name_{name}, id_{id}, explicit_{explic}, cards_{}, parent_{parent}, children_{}, disp_{Set::defdisp() /* TODO */}, sets_{}, bank_{this, "Expression" /* TODO */}, curset_{nullptr}, valid_{true}
+void Deck::invalidate()
+{
+	if (speculator_.joinable())
+	{
+		cancel_ = true;
+		speculator_.join();
+		cancel_ = false;
+	}
+	shadow_.reset();
+	changed_ = std::chrono::steady_clock::now();
+}
+
+Deck::Deck(int id, std::string name, bool explic, Deck *parent) : name_{name}, id_{id}, explicit_{explic}, epoch_{parent ? parent->epoch() : 0}, cards_{}, parent_{parent}, children_{}, disp_{Set::defdisp() /* TODO */}, sets_{}, bank_{this, "Expression" /* TODO */}, curset_{nullptr}, valid_{true}
 {
 	//if (parent == nullptr) explicit_ = true;
 	for (Set::SetType type : Set::settypes()) sets_.insert(std::make_pair(type, Set{this, type}));
+	if (parent_) for (const std::pair<const Set::SetType, std::shared_ptr<const Filter>> &f : parent_->filters()) sets_.insert(std::make_pair(f.first, Set{this, f.first}));
+}
+
+Deck *Deck::find(std::string_view name)
+{
+	std::list<Deck>::iterator iter = std::find_if(decks_.begin(), decks_.end(), [name](const Deck &d) { return d.named(name); });
+	return iter == decks_.end() ? nullptr : &*iter;
 }
 
 Deck &Deck::ensure(std::string name, bool expl)
 {
 	if (name == "") return root;
-	if (exists(name))
+	if (Deck *deck = find(name))
 	{
-		Deck &deck = *std::find_if(decks_.begin(), decks_.end(), [name](const Deck &d) { return d.canonical() == name; });
-		if (expl && ! deck.explicit_) deck.edit(name, expl);
-		return deck;
+		if (expl && ! deck->explicit_) deck->edit(name, expl);
+		return *deck;
 	}
 	else
 	{
-		Deck *parent;
-		std::string parentname = util::dirname(name);
-		ensure(parentname, false);
-		if (parentname == "") parent = &root;
-		else parent = &*std::find_if(decks_.begin(), decks_.end(), [parentname](const Deck &d) { return d.canonical() == parentname; });
-		decks_.emplace_back(Deck{decknum_++, util::basename(name), expl, parent});
-		parent->add_child(&decks_.back());
+		Deck &parent = ensure(std::string{util::dirname(name)}, false);
+		decks_.emplace_back(Deck{decknum_++, std::string{util::basename(name)}, expl, &parent});
+		parent.add_child(&decks_.back());
+		Notify::changed(&decks_.back());
 		return decks_.back();
 	}		
 }
@@ -66,11 +147,15 @@ Deck &Deck::get(std::string name)
 void Deck::del(Deck &deck)
 {
 	if (deck == root || ! deck.valid_) return;
+	invalidate();
+	Notify::Batch batch{};
+	deck.bankindex(false); // Subdecks' cards are not unindexed when ~Deck() deletes them
 	deck.valid_ = false;
 	bool explic = deck.explicit_;
 	Deck *p = deck.parent_;
 	for (std::unordered_set<Card *>::iterator iter = deck.cards_.begin(); iter != deck.cards_.end(); iter = deck.cards_.begin()) Card::del(**iter, true, true); // Otherwise the cards are deleted by ~Deck(), which is instructed not to propagate to the database
 	if (explic) backend::deck_del(deck);
+	Notify::removed(&deck);
 	decks_.erase(std::find_if(decks_.begin(), decks_.end(), [&deck](const Deck &d) { return deck.canonical() == d.canonical(); }));
 	if (p && p->cards_.size() == 0 && p->children_.size() == 0 && ! p->explicit_) del(*p);
 	std::list<Deck>::iterator iterd{};
@@ -78,6 +163,31 @@ void Deck::del(Deck &deck)
 	if (p) p->del_child(&deck, true);
 }
 
+std::unordered_map<const Deck *, std::vector<int>> Deck::forecast(int steps, bool reviews)
+{
+	std::unordered_map<const Deck *, std::vector<int>> ret{};
+	ret[&root].assign(steps, 0);
+	for (const Deck &d : decks_) ret[&d].assign(steps, 0);
+	for (const Card &c : Card::cards()) c.project(ret.at(c.deck()), reviews);
+	std::unordered_map<const Deck *, std::vector<int>> own{ret};
+	for (const Deck &d : decks_) for (const Deck *p = d.parent_; p != nullptr; p = p->parent_)
+	{
+		std::vector<int> &hist = ret.at(p);
+		for (int i = 0; i < steps; i++) hist[i] += own.at(&d)[i];
+	}
+	return ret;
+}
+
+void Deck::resync()
+{
+	invalidate();
+	root.sync();
+	for (Deck &d : decks_) d.sync();
+	for (Deck &d : decks_) d.reindex();
+	root.reindex();
+	rebuild_all();
+}
+
 std::string Deck::freename()
 {
 	int num;
@@ -92,6 +202,13 @@ std::string Deck::canonical() const
 	return parent_->canonical() + "/" + name_;
 }
 
+bool Deck::named(std::string_view name) const
+{
+	if (parent_ == nullptr) return name.empty();
+	if (parent_ == &root) return name == name_;
+	return name.size() > name_.size() && util::basename(name) == name_ && parent_->named(util::dirname(name));
+}
+
 int Deck::totsize() const
 {
 	int ret = cards_.size();
@@ -99,42 +216,124 @@ int Deck::totsize() const
 	return ret;
 }
 
-void Deck::commit(std::string oldname) const
+Set::Displays Deck::disp(Set::SetType type)
+{
+	std::unordered_map<Set::SetType, Set::Displays, Set::sthash> all = disp();
+	if (all.count(type)) return all.at(type);
+	return all.at(Set::SetType::NORMAL);
+}
+
+std::vector<Set::SetType> Deck::settypes() const
+{
+	std::vector<Set::SetType> ret = Set::settypes();
+	for (const std::pair<const Set::SetType, std::shared_ptr<const Filter>> &f : filters()) ret.push_back(f.first);
+	return ret;
+}
+
+std::map<Set::SetType, std::shared_ptr<const Filter>> Deck::filters() const
 {
-	std::string thisoldname = oldname + "/" + name_;
-	if (explicit_) backend::deck_edit(*this, thisoldname);
-	for (const Card *c : cards_) backend::card_update(*c);
-	for (const Deck *d : children_) d->commit(thisoldname);
+	std::map<Set::SetType, std::shared_ptr<const Filter>> ret{};
+	if (parent_) ret = parent_->filters();
+	for (const std::pair<const Set::SetType, std::shared_ptr<const Filter>> &f : filters_) ret[f.first] = f.second;
+	return ret;
 }
 
-void Deck::build()
+void Deck::filters(const std::map<std::string, std::string> &defs, bool fromdb)
 {
-	for (std::pair<const Set::SetType, Set> &s : sets_)
+	if (! explicit_) throw std::runtime_error{"Sets can only be defined on explicit decks"};
+	invalidate(); // Before compiling, which interns comparisons that a speculative build may be reading
+	std::map<Set::SetType, std::shared_ptr<const Filter>> compiled{};
+	for (const std::pair<const std::string, std::string> &def : defs) compiled[Set::custom(def.first)] = std::make_shared<const Filter>(def.second); // Compile everything before changing anything
+	filters_ = std::move(compiled);
+	if (! fromdb) backend::deck_filters(*this);
+	Notify::Batch batch{};
+	resync();
+	Notify::changed(this);
+}
+
+void Deck::sync()
+{
+	std::map<Set::SetType, std::shared_ptr<const Filter>> want = filters();
+	for (std::unordered_map<Set::SetType, Set>::iterator iter = sets_.begin(); iter != sets_.end(); )
 	{
-		s.second.clear();
-		s.second.empty();
+		if (iter->first >= Set::SetType::CUSTOM && ! want.count(iter->first))
+		{
+			iter->second.clear();
+			iter = sets_.erase(iter);
+		}
+		else iter++;
 	}
-	bank().clear();
+	for (const std::pair<const Set::SetType, std::shared_ptr<const Filter>> &f : want) if (! sets_.count(f.first)) sets_.insert(std::make_pair(f.first, Set{this, f.first}));
+}
+
+Deck::Staged Deck::snapshot() const
+{
+	Staged ret{};
+	for (const std::pair<const Set::SetType, Set> &s : sets_)
+	{
+		ret.items[s.first];
+		ret.rands[s.first] = s.second.engine();
+	}
+	return ret;
+}
+
+void Deck::bankindex(bool add)
+{
+	for (Card *c : cards_)
+	{
+		if (add) bank_.index(c);
+		else bank_.unindex(c);
+	}
+	for (Deck *d : children_) d->bankindex(add);
+}
+
+void Deck::prepare(Staged &staged, int diff) const
+{
+	std::deque<Card *> &normal = staged.items[Set::SetType::NORMAL], &all = staged.items[Set::SetType::ALL], &kanji = staged.items[Set::SetType::KANJI], &kana = staged.items[Set::SetType::KANA];
+	std::vector<std::pair<const Filter *, std::deque<Card *> *>> custom{};
+	std::map<Set::SetType, std::shared_ptr<const Filter>> filters = this->filters();
+	for (const std::pair<const Set::SetType, std::shared_ptr<const Filter>> &f : filters) if (staged.items.count(f.first)) custom.push_back(std::make_pair(f.second.get(), &staged.items[f.first]));
+	Filter::Context ctx{};
+	const util::cpset known = bank_.known(diff);
 	for (Card *c : cards_)
 	{
-		if (c->due(0))
+		if (cancel_) return;
+		if (c->due(diff))
 		{
-			sets_.at(Set::SetType::NORMAL).add(c);
-			if (bank().check(c) && sets_.at(Set::SetType::KANJI).size() < sets_.at(Set::SetType::KANA).size()) sets_.at(Set::SetType::KANJI).add(c); // Ensure kanji deck is not larger than kana deck
-			else sets_.at(Set::SetType::KANA).add(c);
+			normal.push_back(c);
+			if (bank_.check(c, known, staged.inset) && kanji.size() < kana.size()) kanji.push_back(c); // Ensure kanji deck is not larger than kana deck
+			else kana.push_back(c);
 		}
-		if (c->avail()) sets_.at(Set::SetType::ALL).add(c);
+		if (c->avail()) all.push_back(c);
+		ctx.next();
+		for (std::pair<const Filter *, std::deque<Card *> *> &f : custom) if ((*f.first)(*c, diff, bank_, known, ctx)) f.second->push_back(c);
 	}
-	for (std::pair<const Set::SetType, Set> &s : sets_) s.second.shuffle();
+	for (std::pair<const Set::SetType, std::default_random_engine> &r : staged.rands) std::shuffle(staged.items[r.first].begin(), staged.items[r.first].end(), r.second);
+}
+
+void Deck::publish(Staged &&staged)
+{
+	bank_.inset(std::move(staged.inset));
+	for (std::pair<const Set::SetType, Set> &s : sets_) s.second.publish(std::move(staged.items[s.first]), staged.rands.at(s.first));
+	Notify::counts(this);
 }
 
 bool Deck::edit(std::string name, bool explic) // This still probably doesn't work quite right if you change whether the deck is explicit
 {
-	if (name == canonical() && explic == explicit_) return true;
-	bool move = (name != canonical() && name != "");
+	if (named(name) && explic == explicit_) return true;
+	invalidate();
+	Notify::Batch batch{};
+	std::map<Set::SetType, std::shared_ptr<const Filter>> oldfilters = filters();
+	int oldepoch = epoch();
+	bankindex(false); // Moving or changing explicitness may change which bank this subtree inherits
+	bool move = (! named(name) && name != "");
 	std::string dest = move ? name : canonical();
-	std::string parent = util::dirname(dest);
-	if (move && exists(dest)) return false;
+	std::string parent{util::dirname(dest)};
+	if (move && exists(dest))
+	{
+		bankindex(true);
+		return false;
+	}
 	//if (explic == false && ! exists(parent)) return false; // TODO Figure out implicit parent decks
 	std::string oldname = canonical();
 	if (move)
@@ -143,36 +342,34 @@ bool Deck::edit(std::string name, bool explic) // This still probably doesn't wo
 		parent_->del_child(this);
 		parent_ = &get(parent);
 		parent_->add_child(this);
-		backend::transac_begin();
-		for (const Card *c : cards_) backend::card_update(*c);
-		for (const Deck *d : children_) d->commit(oldname);
-		backend::transac_end();
-		if (explicit_) bank_.commit(oldname);
+		backend::deck_rename(oldname, canonical());
 	}
-	if (explicit_ && explic) backend::deck_edit(*this, oldname);
-	else if (explicit_ && ! explic) backend::deck_del(*this);
-	else if (! explicit_ && explic) disp_ = disp();
+	if (explicit_ && ! explic) backend::deck_del(*this);
+	else if (! explicit_ && explic)
+	{
+		disp_ = disp();
+		epoch_ = oldepoch;
+	}
+	if (! explic) filters_.clear(); // deck_del has already dropped them from the database
+	bool created = explic && ! explicit_;
 	explicit_ = explic;
-	build();
-	return true;
-}
-
-std::vector<std::string> Deck::vectorize(const std::vector<coldesc> &colspec)
-{
-	std::vector<std::string> ret{};
-	for (coldesc col : colspec)
+	if (created) backend::deck_edit(*this);
+	if (epoch() != oldepoch)
 	{
-		if (col.title == "Name") ret.push_back(canonical());
-		else if (col.title == "Cards") ret.push_back(util::t2s<int>(cards_.size()));
-		else if (col.title == "Due") ret.push_back(util::t2s<int>(sets_.at(Set::SetType::NORMAL).size()));
-		else if (col.title == "Explicit") ret.push_back(explicit_ ? "true" : "false");
-		else ret.push_back("NULL");
+		backend::transac_begin();
+		rebase(epoch() - oldepoch);
+		backend::transac_end();
 	}
-	return ret;
+	bankindex(true);
+	if (filters() != oldfilters) resync();
+	else build();
+	Notify::changed(this);
+	return true;
 }
 
 void Deck::delcard(Card &c, bool refresh)
 {
+	invalidate();
 	s_clear();
 	cards_.erase(std::find(cards_.begin(), cards_.end(), &c));
 	if (cards_.size() == 0 && children_.size() == 0 && ! explicit_)
@@ -183,20 +380,63 @@ void Deck::delcard(Card &c, bool refresh)
 	if (refresh) build();
 }
 
-/*void Deck::shift(int diff)
+void Deck::regroup(Card &c, const util::cpset &known)
 {
+	invalidate();
+	bool repeat = false;
+	if (c.due(0))
+	{
+		Set &kanji = set(Set::SetType::KANJI), &kana = set(Set::SetType::KANA);
+		bool covered = bank_.covers(&c, known);
+		if (covered && ! kanji.has(&c) && kanji.own() < kana.own() && kana.take(&c, repeat)) kanji.give(&c, repeat); // Same balance as prepare()
+		else if (! covered && kanji.take(&c, repeat)) kana.give(&c, repeat);
+	}
+	Filter::Context ctx{};
+	for (const std::pair<const Set::SetType, std::shared_ptr<const Filter>> &f : filters())
+	{
+		if (! f.second->bank() || ! hasset(f.first)) continue;
+		Set &s = set(f.first);
+		if (! (*f.second)(c, 0, bank_, known, ctx)) s.take(&c, repeat);
+		else if (! s.has(&c)) s.give(&c, false);
+	}
+	Notify::counts(this);
+}
+
+void Deck::shift(int diff)
+{
+	if (this == &root || ! explicit_) throw std::runtime_error{"Only explicit decks can be shifted"};
+	invalidate();
+	Notify::Batch batch{};
 	backend::transac_begin();
-	for (Card *c : cards_) c->shift(diff);
-	backend::transac_end();
-	backend::transac_begin();
-	bank_.shift(diff);
+	bumpepoch(diff);
 	backend::transac_end();
-	build();
-}*/
+	rebuild_all();
+}
+
+void Deck::bumpepoch(int diff) // Implicit subdecks follow along for free
+{
+	if (explicit_)
+	{
+		epoch_ += diff;
+		backend::deck_epoch(*this);
+	}
+	for (Deck *d : children_) d->bumpepoch(diff);
+}
+
+void Deck::rebase(int diff)
+{
+	for (Card *c : cards_)
+	{
+		c->rebase(diff);
+		backend::card_update(*c);
+	}
+	for (Deck *d : children_) if (! d->explicit_) d->rebase(diff);
+}
 
 void Deck::remove()
 {
 	valid_ = false;
+	Notify::removed(this);
 	for (std::unordered_set<Card *>::iterator iter = cards_.begin(); iter != cards_.end(); iter = cards_.begin()) Card::del(**iter, false);
 	if (parent_) parent_->del_child(this, false);
 	//std::list<int, Card>::iterator iterc{};
@@ -17,29 +17,73 @@
 #include <random>
 #include <chrono>
 #include <cassert>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <map>
+#include <exception>
 #include "Bank.h"
 #include "Set.h"
+#include "Filter.h"
 #include "coldesc.h"
+#include "Notify.h"
+#include "Watchdog.h"
 
 class Deck
 {
+public:
+	class Batch // Defers building decks until the outermost batch ends, then builds each touched deck once, with all database writes in one transaction and all notifications in one update
+	{
+	private:
+		Notify::Batch notify_;
+		bool transac_;
+	public:
+		Batch();
+		Batch(const Batch &orig) = delete;
+		~Batch() noexcept(false);
+	};
 private:
+	struct Staged // Set contents computed by prepare() and installed by publish()
+	{
+		std::unordered_map<Set::SetType, std::deque<Card *>> items;
+		std::unordered_map<Set::SetType, std::default_random_engine> rands;
+		util::cpset inset;
+	};
+	struct Generation // Speculatively prepared contents of every deck for a future step
+	{
+		int step;
+		std::vector<std::pair<Deck *, Staged>> decks;
+	};
+	static std::thread speculator_;
+	static std::atomic<bool> speculated_, cancel_;
+	static std::unique_ptr<Generation> shadow_; // Only touched by the main thread once the speculator is joined
+	static std::chrono::steady_clock::time_point changed_; // Last invalidate()
+	static constexpr std::chrono::milliseconds quiet_{2000}; // How long the model must go unchanged before speculating, so studying doesn't rebuild everything after each card
+	static int batch_; // Depth of open Batches
+	static std::unordered_set<Deck *> stale_; // Decks to build when the outermost Batch ends
 	static std::list<Deck> decks_;
 	static int decknum_;
-	static std::default_random_engine rand_;
+	static unsigned int seed_;
 	static Deck &ensure(std::string name, bool expl);
+	static Deck *find(std::string_view name); // Null if there is no deck with this canonical name
 public:
 	static Deck root;
 	static int curstep; // Maybe this should be private
-	static bool exists(std::string deck) { return std::find_if(decks_.begin(), decks_.end(), [&deck](const Deck &d) { return d.canonical() == deck; }) != decks_.end(); }
+	static bool exists(std::string_view deck) { return find(deck) != nullptr; }
 	static Deck &add(std::string name, bool fromdb = false);
 	static Deck &get(std::string name);
 	static std::list<Deck> &decks() { return decks_; }
 	static void del(Deck &deck);
 	static std::string freename();
-	static void rebuild_all() { for (Deck &d : decks_) d.build(); }
+	static unsigned int seed() { return seed_; }
+	static void seed(unsigned int s) { seed_ = s; } // Only affects sets created afterward
+	static void rebuild_all();
+	static void speculate(); // Start preparing the next step's sets in the background, if not already done and nothing has changed for a while
+	static void invalidate(); // Discard any speculative sets.  Call before changing anything a build depends on.
 	//static void shift_all(int diff) { for (Deck &d : decks_) d.shift(diff); };
 	static void step(int offset);
+	static std::unordered_map<const Deck *, std::vector<int>> forecast(int steps, bool reviews = false); // Cards falling due at each of the next steps, including subdecks
+	static void resync(); // Bring every deck's user-defined sets in line with the filters it inherits, then rebuild
 	static void printtree(Deck *d = &root, std::string prefix = "") // For debug
 	{
 		std::cerr << prefix << d << " " << d->name_ << "\n";
@@ -50,57 +94,76 @@ private:
 	std::string name_;
 	int id_;
 	bool explicit_;
+	int epoch_; // Steps of this deck's cards and bank are stored relative to this; implicit decks use their parent's
 	std::unordered_set<Card *> cards_;
 	Deck *parent_;
 	std::unordered_set<Deck *> children_;
-	std::unordered_map<Set::SetType, std::unordered_map<Set::DispType, std::unordered_set<std::vector<Card::Field>, Set::vfhash>, Set::dthash>, Set::sthash> disp_;
+	std::unordered_map<Set::SetType, Set::Displays, Set::sthash> disp_; // Templates for each side of each set
 	std::unordered_map<Set::SetType, Set> sets_;
+	std::map<Set::SetType, std::shared_ptr<const Filter>> filters_; // User-defined sets introduced by this deck
 	Bank bank_;
 	Set *curset_;
 	bool valid_;
 	Deck(int id, std::string name, bool explic, Deck *parent);
 	int totsize() const;
-	void commit(std::string oldname) const;
+	void reindex() { if (valid_) for (std::pair<const Set::SetType, Set> &s : sets_) s.second.reindex(); }
+	void sync();
+	void bankindex(bool add); // Add or remove this deck's and its subdecks' cards in their bank's index
+	void rebase(int diff); // Keep the schedules of cards that use this deck's epoch when it moves by diff
+	void bumpepoch(int diff);
 	void remove();
-	std::unordered_map<Set::SetType, std::unordered_map<Set::DispType, std::unordered_set<std::vector<Card::Field>, Set::vfhash>, Set::dthash>, Set::sthash> disp() { if (explicit_) return disp_; return parent_->disp(); };
+	std::unordered_map<Set::SetType, Set::Displays, Set::sthash> disp() { if (explicit_) return disp_; return parent_->disp(); };
 public:
 	Deck() = delete;
 	Deck(const Deck& orig) = delete;
-	Deck(Deck&& orig) : name_{orig.name_}, id_{orig.id_}, explicit_{orig.explicit_}, cards_{std::move(orig.cards_)}, parent_{orig.parent_}, children_{std::move(orig.children_)}, disp_{orig.disp_}, sets_{std::move(orig.sets_)}, bank_{orig.bank_}, curset_{orig.curset_}, valid_{true}
+	Deck(Deck&& orig) : name_{orig.name_}, id_{orig.id_}, explicit_{orig.explicit_}, epoch_{orig.epoch_}, cards_{std::move(orig.cards_)}, parent_{orig.parent_}, children_{std::move(orig.children_)}, disp_{orig.disp_}, sets_{std::move(orig.sets_)}, filters_{std::move(orig.filters_)}, bank_{orig.bank_}, curset_{orig.curset_}, valid_{true}
 	{
 		orig.valid_ = false;
 		for (std::pair<const Set::SetType, Set> &pair : sets_) pair.second.deck(this);
 		bank_.deck(this);
 	}
 	Deck operator =(const Deck& orig) = delete;
-	virtual ~Deck() { if (valid_) remove(); }
+	virtual ~Deck() { stale_.erase(this); if (valid_) remove(); }
 	
 	std::string name() const { return name_; }
 	std::string canonical() const;
+	bool named(std::string_view name) const; // Same as canonical() == name, without building the name
 	Deck *parent() const { return parent_; }
 	std::unordered_set<Deck *> children() const { return children_; }
 	int id() const { return id_; }
 	int size() const { return cards_.size(); }
 	const std::unordered_set<Card *> &cards() const { return cards_; }
 	bool explic() const { return explicit_; }
+	int epoch() const { for (const Deck *d = this; d != nullptr; d = d->parent_) if (d->explicit_) return d->epoch_; return root.epoch_; }
+	bool valid() const { return valid_; }
 	Deck *inherited() { for (Deck *d = this; d != nullptr; d = d->parent_) if (d->explicit_) return d; return &root; }
 	bool has(Card &card) const { return card.deck() == this; }
 	friend bool operator ==(const Deck &a, const Deck &b) { return a.id_ == b.id_; }
 	Set &set(Set::SetType type) { return sets_.at(type); }
+	bool hasset(Set::SetType type) const { return sets_.count(type) > 0; }
+	std::vector<Set::SetType> settypes() const;
+	std::map<Set::SetType, std::shared_ptr<const Filter>> filters() const; // Including those inherited from ancestors
+	const std::map<Set::SetType, std::shared_ptr<const Filter>> &ownfilters() const { return filters_; }
 	Bank &bank() { return bank_; }
-	std::unordered_map<Set::DispType, std::unordered_set<std::vector<Card::Field>, Set::vfhash>, Set::dthash> disp(Set::SetType type) { return disp().at(type); }
+	const Bank &bank() const { return bank_; }
+	Set::Displays disp(Set::SetType type); // User-defined sets display like NORMAL
 	std::unordered_map<Set::SetType, Set> &sets() { return sets_; }
-	std::vector<std::string> vectorize(const std::vector<coldesc> &colspec);
 	int ncards() { int n = cards_.size(); for (Deck *d : children_) n += d->ncards(); return n; }
 
-	//void shift(int diff);
-	void add_child(Deck *d, bool refresh = true) { children_.insert(d); if (refresh) build(); }
-	void del_child(Deck *d, bool refresh = true) { children_.erase(d); if (refresh) build(); }
+	void epoch(int e) { invalidate(); epoch_ = e; } // For loading
+	void shift(int diff); // Postpone this deck and its subdecks by diff steps, or bring them forward if negative
+	void add_child(Deck *d, bool refresh = true) { invalidate(); children_.insert(d); reindex(); if (refresh) build(); }
+	void del_child(Deck *d, bool refresh = true) { invalidate(); children_.erase(d); reindex(); if (refresh) build(); }
 	bool edit(std::string name, bool explic);
-	void build();
+	void filters(const std::map<std::string, std::string> &defs, bool fromdb = false); // Replace this deck's user-defined sets, given as name -> filter expression
+	void build() { if (batch_) { stale_.insert(this); return; } Watchdog::Phase phase{Watchdog::Part::MODEL}; Staged staged = snapshot(); prepare(staged); publish(std::move(staged)); }
+	Staged snapshot() const;
+	void prepare(Staged &staged, int diff = 0) const; // Sort cards due diff steps from now into staged; reads only this deck and its inherited bank, so may run off the main thread
+	void publish(Staged &&staged);
 	void s_clear() { for (std::pair<const Set::SetType, Set> &s : sets_) s.second.clear(); }
-	void addcard(Card &c, bool refresh = true) { cards_.insert(&c); if (refresh) build(); }
+	void addcard(Card &c, bool refresh = true) { invalidate(); cards_.insert(&c); if (refresh) build(); }
 	void delcard(Card &c, bool refresh = true);
+	void regroup(Card &c, const util::cpset &known); // Re-sort one card among the bank-dependent sets after the bank changed, leaving the rest of each set alone
 };
 
 namespace std { template <> struct hash<Deck> { size_t operator ()(const Deck &x) const { return static_cast<size_t>(x.id()); } }; }
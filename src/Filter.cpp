@@ -0,0 +1,224 @@
+/*
+ * File:   Filter.cpp
+ * Author: matt
+ *
+ * Created on October 19, 2026, 10:12 AM
+ */
+
+#include "Filter.h"
+#include "Bank.h"
+
+std::vector<std::weak_ptr<const Filter::Text>> Filter::interned_{};
+
+static std::vector<std::string> lex(const std::string &expr)
+{
+	std::vector<std::string> ret{};
+	std::size_t i = 0;
+	while (i < expr.size())
+	{
+		char c = expr[i];
+		if (c == ' ' || c == '\t' || c == '\n' || c == '\r') i++;
+		else if (c == '"')
+		{
+			std::string tok{"\""};
+			for (i++; i < expr.size() && expr[i] != '"'; i++)
+			{
+				if (expr[i] == '\\' && i + 1 < expr.size()) i++;
+				tok += expr[i];
+			}
+			if (i >= expr.size()) throw std::runtime_error{"Unterminated string in filter \"" + expr + "\""};
+			i++;
+			ret.push_back(tok);
+		}
+		else if (c == '(' || c == ')' || c == '~') ret.push_back(std::string(1, expr[i++]));
+		else if (c == '=' || c == '!' || c == '<' || c == '>' || c == '&' || c == '|')
+		{
+			std::size_t len = (i + 1 < expr.size() && (expr[i + 1] == '=' || (expr[i + 1] == c && (c == '&' || c == '|')))) ? 2 : 1;
+			ret.push_back(expr.substr(i, len));
+			i += len;
+		}
+		else
+		{
+			std::size_t start = i;
+			while (i < expr.size() && std::string{" \t\n\r\"()~=!<>&|"}.find(expr[i]) == std::string::npos) i++;
+			ret.push_back(expr.substr(start, i - start));
+		}
+	}
+	return ret;
+}
+
+std::shared_ptr<const Filter::Text> Filter::intern(const std::string &field, Cmp cmp, const std::string &value)
+{
+	unsigned int slot = interned_.size();
+	for (unsigned int i = 0; i < interned_.size(); i++)
+	{
+		std::shared_ptr<const Text> text = interned_[i].lock();
+		if (! text) slot = std::min(slot, i);
+		else if (text->field == field && text->cmp == cmp && text->value == value) return text;
+	}
+	std::shared_ptr<const Text> ret = std::make_shared<const Text>(Text{field, cmp, value, slot});
+	if (slot == interned_.size()) interned_.push_back(ret);
+	else interned_[slot] = ret;
+	return ret;
+}
+
+bool Filter::compare(int a, Cmp cmp, int b)
+{
+	switch (cmp)
+	{
+		case Cmp::EQ: return a == b;
+		case Cmp::NE: return a != b;
+		case Cmp::LT: return a < b;
+		case Cmp::LE: return a <= b;
+		case Cmp::GT: return a > b;
+		case Cmp::GE: return a >= b;
+		default: return false;
+	}
+}
+
+Filter::Filter(const std::string &expr) : expr_{expr}, code_{}, texts_{}
+{
+	std::vector<std::string> toks = lex(expr);
+	if (toks.empty()) throw std::runtime_error{"Empty filter"};
+	std::size_t pos = 0;
+	this->expr(toks, pos);
+	if (pos != toks.size()) throw std::runtime_error{"Unexpected \"" + toks[pos] + "\" in filter \"" + expr + "\""};
+}
+
+void Filter::expr(const std::vector<std::string> &toks, std::size_t &pos)
+{
+	std::vector<std::size_t> jumps{};
+	term(toks, pos);
+	while (pos < toks.size() && (toks[pos] == "or" || toks[pos] == "||"))
+	{
+		pos++;
+		jumps.push_back(code_.size());
+		code_.push_back(Instr{Op::JTRUE, Cmp::EQ, 0, 0});
+		term(toks, pos);
+	}
+	for (std::size_t j : jumps) code_[j].arg = code_.size();
+}
+
+void Filter::term(const std::vector<std::string> &toks, std::size_t &pos)
+{
+	std::vector<std::size_t> jumps{};
+	factor(toks, pos);
+	while (pos < toks.size() && (toks[pos] == "and" || toks[pos] == "&&"))
+	{
+		pos++;
+		jumps.push_back(code_.size());
+		code_.push_back(Instr{Op::JFALSE, Cmp::EQ, 0, 0});
+		factor(toks, pos);
+	}
+	for (std::size_t j : jumps) code_[j].arg = code_.size();
+}
+
+void Filter::factor(const std::vector<std::string> &toks, std::size_t &pos)
+{
+	if (pos >= toks.size()) throw std::runtime_error{"Unexpected end of filter \"" + expr_ + "\""};
+	if (toks[pos] == "not" || toks[pos] == "!")
+	{
+		pos++;
+		factor(toks, pos);
+		code_.push_back(Instr{Op::NOT, Cmp::EQ, 0, 0});
+	}
+	else if (toks[pos] == "(")
+	{
+		pos++;
+		expr(toks, pos);
+		if (pos >= toks.size() || toks[pos] != ")") throw std::runtime_error{"Missing \")\" in filter \"" + expr_ + "\""};
+		pos++;
+	}
+	else atom(toks, pos);
+}
+
+void Filter::atom(const std::vector<std::string> &toks, std::size_t &pos)
+{
+	const std::string &name = toks[pos++];
+	if (name == "due") { code_.push_back(Instr{Op::DUE, Cmp::EQ, 0, 0}); return; }
+	if (name == "avail") { code_.push_back(Instr{Op::AVAIL, Cmp::EQ, 0, 0}); return; }
+	if (name == "bank") { code_.push_back(Instr{Op::BANK, Cmp::EQ, 0, 0}); return; }
+	if (pos + 1 >= toks.size()) throw std::runtime_error{"Incomplete comparison on \"" + name + "\" in filter \"" + expr_ + "\""};
+	const std::string &op = toks[pos++], &operand = toks[pos++];
+	Cmp cmp;
+	if (op == "==" || op == "=") cmp = Cmp::EQ;
+	else if (op == "!=") cmp = Cmp::NE;
+	else if (op == "<") cmp = Cmp::LT;
+	else if (op == "<=") cmp = Cmp::LE;
+	else if (op == ">") cmp = Cmp::GT;
+	else if (op == ">=") cmp = Cmp::GE;
+	else if (op == "~") cmp = Cmp::HAS;
+	else throw std::runtime_error{"Invalid operator \"" + op + "\" in filter \"" + expr_ + "\""};
+	std::string text = (operand.size() && operand[0] == '"') ? operand.substr(1) : operand;
+	if (name == "status")
+	{
+		if (cmp != Cmp::EQ && cmp != Cmp::NE) throw std::runtime_error{"Status can only be compared with == or !="};
+		code_.push_back(Instr{Op::STATUS, cmp, static_cast<int>(Card::str2stat(text)), 0});
+		return;
+	}
+	std::vector<std::string> attrs{"offset", "interval", "norm", "incr", "decr", "reset"};
+	std::vector<std::string>::iterator attr = std::find(attrs.begin(), attrs.end(), name);
+	if (attr != attrs.end())
+	{
+		if (cmp == Cmp::HAS) throw std::runtime_error{"Operator ~ only applies to fields"};
+		if (text.empty() || text.find_first_not_of("-0123456789") != std::string::npos) throw std::runtime_error{"Expected a number after \"" + name + " " + op + "\" in filter \"" + expr_ + "\""};
+		code_.push_back(Instr{Op::ATTR, cmp, static_cast<int>(attr - attrs.begin()), util::s2t<int>(text)});
+		return;
+	}
+	std::vector<std::string> fields = Card::fieldnames();
+	if (std::find(fields.begin(), fields.end(), name) == fields.end()) throw std::runtime_error{"Unknown field \"" + name + "\" in filter \"" + expr_ + "\""};
+	if (cmp != Cmp::EQ && cmp != Cmp::NE && cmp != Cmp::HAS) throw std::runtime_error{"Fields can only be compared with ==, != or ~"};
+	texts_.push_back(intern(name, cmp == Cmp::NE ? Cmp::EQ : cmp, text));
+	code_.push_back(Instr{Op::TEXT, Cmp::EQ, static_cast<int>(texts_.size() - 1), 0});
+	if (cmp == Cmp::NE) code_.push_back(Instr{Op::NOT, Cmp::EQ, 0, 0});
+}
+
+bool Filter::operator ()(const Card &card, int diff, const Bank &bank, const util::cpset &known, Context &ctx) const
+{
+	bool acc = false;
+	for (std::size_t pc = 0; pc < code_.size(); pc++)
+	{
+		const Instr &in = code_[pc];
+		switch (in.op)
+		{
+			case Op::DUE: acc = card.due(diff); break;
+			case Op::AVAIL: acc = card.avail(); break;
+			case Op::BANK: acc = bank.covers(&card, known); break;
+			case Op::STATUS: acc = (static_cast<int>(card.status()) == in.arg) == (in.cmp == Cmp::EQ); break;
+			case Op::ATTR:
+			{
+				int val = 0;
+				switch (static_cast<Attr>(in.arg))
+				{
+					case Attr::OFFSET: val = card.offset() - diff; break;
+					case Attr::INTERVAL: val = card.delay(); break;
+					case Attr::NORM: val = card.count(Card::UpdateType::NORM); break;
+					case Attr::INCR: val = card.count(Card::UpdateType::INCR); break;
+					case Attr::DECR: val = card.count(Card::UpdateType::DECR); break;
+					case Attr::RESET: val = card.count(Card::UpdateType::RESET); break;
+				}
+				acc = compare(val, in.cmp, in.value);
+				break;
+			}
+			case Op::TEXT:
+			{
+				const Text &text = *texts_[in.arg];
+				if (ctx.memo_.size() <= text.slot) ctx.memo_.resize(text.slot + 1, std::make_pair(0ul, false));
+				std::pair<unsigned long, bool> &memo = ctx.memo_[text.slot];
+				if (memo.first != ctx.stamp_)
+				{
+					if (! card.hasfield(text.field)) memo.second = false;
+					else if (text.cmp == Cmp::HAS) memo.second = card.field(text.field).find(text.value) != std::string::npos;
+					else memo.second = card.field(text.field) == text.value;
+					memo.first = ctx.stamp_;
+				}
+				acc = memo.second;
+				break;
+			}
+			case Op::NOT: acc = ! acc; break;
+			case Op::JFALSE: if (! acc) pc = in.arg - 1; break;
+			case Op::JTRUE: if (acc) pc = in.arg - 1; break;
+		}
+	}
+	return acc;
+}
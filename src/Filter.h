@@ -0,0 +1,90 @@
+/*
+ * File:   Filter.h
+ * Author: matt
+ *
+ * Created on October 19, 2026, 10:12 AM
+ */
+
+#ifndef FILTER_H
+#define	FILTER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include "Card.h"
+
+class Bank;
+
+/*
+ * Membership rule for a user-defined set.  The grammar is
+ *
+ *	expr   := term { "or" term }
+ *	term   := factor { "and" factor }
+ *	factor := "not" factor | "(" expr ")" | atom
+ *	atom   := "due" | "avail" | "bank" | "status" ("==" | "!=") status | attr cmp integer | field ("==" | "!=" | "~") "text"
+ *	attr   := "offset" | "interval" | "norm" | "incr" | "decr" | "reset"
+ *
+ * where status is one of the names accepted by Card::str2stat, field is a card field name, and "~" tests whether
+ * the field contains the text.  "&&", "||" and "!" may stand in for the keywords.  For example, recently missed
+ * cards are "decr > 0 and interval <= 2", and an expression drill is "avail and Expression ~ \"する\"".
+ *
+ * The expression is compiled once into a flat program over a single accumulator, with "and" and "or" compiled
+ * to short-circuiting jumps.  Text comparisons are interned across all live filters so that evaluating many filters
+ * against one card performs each distinct comparison only once.  Each filter holds its own comparisons, so it can be
+ * evaluated off the main thread while others are compiled, and a comparison's slot is reused once no filter has it.
+ */
+class Filter
+{
+public:
+	class Context // Per-thread scratch space remembering which text comparisons have been made for the current card
+	{
+	private:
+		friend class Filter;
+		std::vector<std::pair<unsigned long, bool>> memo_;
+		unsigned long stamp_;
+	public:
+		Context() : memo_{}, stamp_{1} { }
+		void next() { stamp_++; } // Call before evaluating filters against a new card
+	};
+private:
+	enum class Op { DUE, AVAIL, BANK, STATUS, ATTR, TEXT, NOT, JFALSE, JTRUE };
+	enum class Attr { OFFSET, INTERVAL, NORM, INCR, DECR, RESET };
+	enum class Cmp { EQ, NE, LT, LE, GT, GE, HAS };
+	struct Instr
+	{
+		Op op;
+		Cmp cmp;
+		int arg; // Attribute, status, index into texts_ or jump target
+		int value; // Comparand for attributes
+	};
+	struct Text
+	{
+		std::string field;
+		Cmp cmp;
+		std::string value;
+		unsigned int slot; // In Context::memo_, shared by equal comparisons
+	};
+	static std::vector<std::weak_ptr<const Text>> interned_; // By slot; expired slots are free.  Main thread only.
+	static std::shared_ptr<const Text> intern(const std::string &field, Cmp cmp, const std::string &value);
+	static bool compare(int a, Cmp cmp, int b);
+
+	std::string expr_;
+	std::vector<Instr> code_;
+	std::vector<std::shared_ptr<const Text>> texts_;
+	void expr(const std::vector<std::string> &toks, std::size_t &pos);
+	void term(const std::vector<std::string> &toks, std::size_t &pos);
+	void factor(const std::vector<std::string> &toks, std::size_t &pos);
+	void atom(const std::vector<std::string> &toks, std::size_t &pos);
+public:
+	Filter() = delete;
+	Filter(const std::string &expr);
+
+	const std::string &expr() const { return expr_; }
+	bool bank() const { return std::find_if(code_.begin(), code_.end(), [](const Instr &in) { return in.op == Op::BANK; }) != code_.end(); } // Whether the result depends on the bank
+	bool operator ()(const Card &card, int diff, const Bank &bank, const util::cpset &known, Context &ctx) const; // known is bank.known(diff)
+};
+
+#endif	/* FILTER_H */
+
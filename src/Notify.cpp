@@ -0,0 +1,99 @@
+/*
+ * File:   Notify.cpp
+ * Author: matt
+ *
+ * Created on October 19, 2026
+ */
+
+#include "Notify.h"
+#include "Deck.h"
+#include "Watchdog.h"
+
+std::vector<Notify::Listener> Notify::listeners_{};
+Notify::Changes Notify::pending_{};
+int Notify::depth_ = 0;
+bool Notify::live_ = false;
+static struct Closer { ~Closer() { Notify::close(); } } closer{}; // Destroyed before the members above, so decks torn down after them publish nothing
+
+void Notify::flush()
+{
+	if (! live_ || pending_.empty()) return;
+	Changes changes{};
+	std::swap(changes, pending_); // Listeners may publish more, which start a new round
+	Watchdog::Phase phase{Watchdog::Part::WIDGET}; // Patching the views is not the model's time, even when a model call published the changes
+	for (const Listener &listener : listeners_) listener(changes);
+}
+
+void Notify::added(Card *card)
+{
+	if (! live_) return;
+	pending_.removed.erase(card); // The allocator reused the address, so the old row can show the new card
+	pending_.added.insert(card);
+	if (! depth_) flush();
+}
+
+void Notify::removed(const Card *card)
+{
+	if (! live_) return;
+	Card *key = const_cast<Card *>(card); // Only used for lookup
+	if (pending_.added.erase(key)) pending_.updated.erase(key); // Never shown, so nothing to take out
+	else
+	{
+		pending_.updated.erase(key);
+		pending_.removed.insert(card);
+	}
+	if (! depth_) flush();
+}
+
+void Notify::updated(Card *card)
+{
+	if (! live_) return;
+	if (! pending_.added.count(card)) pending_.updated.insert(card);
+	if (! depth_) flush();
+}
+
+void Notify::changed(Deck *deck)
+{
+	if (! live_) return;
+	std::vector<Deck *> stack{deck};
+	while (! stack.empty())
+	{
+		Deck *cur = stack.back();
+		stack.pop_back();
+		pending_.gone.erase(cur);
+		pending_.decks.insert(cur);
+		for (Deck *child : cur->children()) stack.push_back(child);
+	}
+	if (! depth_) flush();
+}
+
+void Notify::removed(const Deck *deck)
+{
+	if (! live_) return;
+	Deck *key = const_cast<Deck *>(deck); // Only used for lookup
+	pending_.decks.erase(key);
+	pending_.counts.erase(key);
+	pending_.gone.insert(deck);
+	if (! depth_) flush();
+}
+
+void Notify::counts(Deck *deck)
+{
+	if (! live_) return;
+	for (Deck *cur = deck; cur; cur = cur->parent()) if (! pending_.counts.insert(cur).second) break; // Ancestors are already in if this one is
+	if (! depth_) flush();
+}
+
+void Notify::bank()
+{
+	if (! live_) return;
+	pending_.bank = true;
+	if (! depth_) flush();
+}
+
+void Notify::all()
+{
+	if (! live_) return;
+	pending_.all = true;
+	if (! depth_) flush();
+}
@@ -0,0 +1,66 @@
+/*
+ * File:   Notify.h
+ * Author: matt
+ *
+ * Created on October 19, 2026
+ */
+
+#ifndef NOTIFY_H
+#define	NOTIFY_H
+
+#include <unordered_set>
+#include <vector>
+#include <functional>
+
+class Card;
+class Deck;
+
+/*
+ * Change notifications from the model to the views.  Mutators publish what they touched; listeners receive the
+ * accumulated changes once the outermost Batch ends, or immediately outside of any batch, and patch only the
+ * affected rows.  Removed pointers must not be dereferenced, since the objects are already gone by then.
+ * Notifications are only published from the main thread.
+ */
+class Notify
+{
+public:
+	struct Changes
+	{
+		std::unordered_set<Card *> added, updated;
+		std::unordered_set<const Card *> removed;
+		std::unordered_set<Deck *> decks; // Created, renamed, moved, or changed explicitness or sets, with their subdecks
+		std::unordered_set<const Deck *> gone;
+		std::unordered_set<Deck *> counts; // Set sizes changed, with their ancestors
+		bool bank; // Some bank's words or sections changed
+		bool all; // Any card's schedule may have changed, as when the step moves
+		bool empty() const { return added.empty() && updated.empty() && removed.empty() && decks.empty() && gone.empty() && counts.empty() && ! bank && ! all; }
+	};
+	typedef std::function<void(const Changes &)> Listener;
+	class Batch // Holds notifications until the outermost batch goes out of scope
+	{
+	public:
+		Batch() { depth_++; }
+		Batch(const Batch &orig) = delete;
+		~Batch() { if (--depth_ == 0) flush(); }
+	};
+private:
+	static std::vector<Listener> listeners_;
+	static Changes pending_;
+	static int depth_;
+	static bool live_; // Only once someone subscribes, which also keeps static construction and destruction from touching the containers
+	static void flush();
+public:
+	static void subscribe(Listener listener) { listeners_.push_back(listener); live_ = true; }
+	static void close() { live_ = false; } // Drop everything from here on, so teardown doesn't call into destroyed views
+	static void added(Card *card);
+	static void removed(const Card *card);
+	static void updated(Card *card);
+	static void changed(Deck *deck);
+	static void removed(const Deck *deck);
+	static void counts(Deck *deck);
+	static void bank();
+	static void all();
+};
+
+#endif	/* NOTIFY_H */
+
@@ -0,0 +1,96 @@
+/*
+ * File:   Render.cpp
+ * Author: matt
+ *
+ * Created on October 19, 2026
+ */
+
+#include "Render.h"
+
+Render::Render() : cache_{}, order_{}, jobs_{}, lock_{}, wake_{}, stop_{false}, worker_{}
+{
+	worker_ = std::thread{[this]() { work(); }};
+}
+
+Render::~Render()
+{
+	{
+		std::unique_lock<std::mutex> lock{lock_};
+		stop_ = true;
+		jobs_.clear();
+	}
+	wake_.notify_all();
+	if (worker_.joinable()) worker_.join();
+}
+
+void Render::store(const Key &key, int revision, const Face &face)
+{
+	std::unordered_map<Key, Entry, khash>::iterator iter = cache_.find(key);
+	if (iter != cache_.end())
+	{
+		if (iter->second.revision < revision) iter->second = Entry{revision, face};
+		return;
+	}
+	cache_[key] = Entry{revision, face};
+	order_.push_back(key);
+	while (cache_.size() > capacity_)
+	{
+		cache_.erase(order_.front());
+		order_.pop_front();
+	}
+}
+
+void Render::work()
+{
+	std::unique_lock<std::mutex> lock{lock_};
+	while (true)
+	{
+		wake_.wait(lock, [this]() { return stop_ || ! jobs_.empty(); });
+		if (stop_) return;
+		Job job = std::move(jobs_.front());
+		jobs_.pop_front();
+		lock.unlock();
+		std::vector<const std::string *> slots{};
+		slots.reserve(job.fields.size());
+		for (const std::string &field : job.fields) slots.push_back(&field);
+		std::shared_ptr<std::vector<Card::Block>> face = std::make_shared<std::vector<Card::Block>>();
+		job.key.tmpl->render(slots, *face);
+		lock.lock();
+		store(job.key, job.revision, face);
+	}
+}
+
+Render::Face Render::face(const Card &card, const Template &tmpl)
+{
+	Key key{card.id(), &tmpl};
+	{
+		std::unique_lock<std::mutex> lock{lock_};
+		std::unordered_map<Key, Entry, khash>::const_iterator iter = cache_.find(key);
+		if (iter != cache_.end() && iter->second.revision == card.revision()) return iter->second.face;
+	}
+	std::shared_ptr<std::vector<Card::Block>> ret = std::make_shared<std::vector<Card::Block>>();
+	tmpl.render(card.slots(), *ret);
+	std::unique_lock<std::mutex> lock{lock_};
+	store(key, card.revision(), ret);
+	return ret;
+}
+
+void Render::prefetch(const Card &card, const Template &tmpl)
+{
+	Key key{card.id(), &tmpl};
+	std::unique_lock<std::mutex> lock{lock_};
+	std::unordered_map<Key, Entry, khash>::const_iterator iter = cache_.find(key);
+	if (iter != cache_.end() && iter->second.revision == card.revision()) return;
+	for (const Job &job : jobs_) if (job.key == key && job.revision == card.revision()) return;
+	std::vector<std::string> fields{};
+	fields.reserve(card.slots().size());
+	for (const std::string *field : card.slots()) fields.push_back(field ? *field : "");
+	jobs_.push_back(Job{key, card.revision(), std::move(fields)});
+	wake_.notify_one();
+}
+
+void Render::clear()
+{
+	std::unique_lock<std::mutex> lock{lock_};
+	jobs_.clear();
+}
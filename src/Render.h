@@ -0,0 +1,65 @@
+/*
+ * File:   Render.h
+ * Author: matt
+ *
+ * Created on October 19, 2026
+ */
+
+#ifndef RENDER_H
+#define	RENDER_H
+
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Card.h"
+#include "Template.h"
+
+class Render // What the study view shows for each card and choice of fields, prepared ahead of time on a worker thread so that showing a card is a lookup
+{
+public:
+	typedef std::shared_ptr<const std::vector<Card::Block>> Face;
+private:
+	struct Key
+	{
+		int id;
+		const Template *tmpl;
+		bool operator ==(const Key &other) const { return id == other.id && tmpl == other.tmpl; }
+	};
+	struct khash { size_t operator ()(const Key &x) const { return std::hash<int>{}(x.id) * 31 + std::hash<const Template *>{}(x.tmpl); } };
+	struct Entry
+	{
+		int revision; // Card::revision() when rendered
+		Face face;
+	};
+	struct Job
+	{
+		Key key;
+		int revision;
+		std::vector<std::string> fields; // Copy of the card's slots(), since the main thread may edit it meanwhile
+	};
+	static const std::size_t capacity_ = 512;
+	std::unordered_map<Key, Entry, khash> cache_;
+	std::deque<Key> order_; // Oldest first, for eviction
+	std::deque<Job> jobs_;
+	std::mutex lock_;
+	std::condition_variable wake_;
+	bool stop_;
+	std::thread worker_;
+	void store(const Key &key, int revision, const Face &face); // Call with lock_ held
+	void work();
+public:
+	Render();
+	Render(const Render &orig) = delete;
+	~Render();
+	Face face(const Card &card, const Template &tmpl); // From the cache if it is current, or rendered now
+	void prefetch(const Card &card, const Template &tmpl); // Queue a card to be rendered in the background
+	void clear(); // Drop queued work that is no longer wanted
+};
+
+#endif	/* RENDER_H */
+
@@ -0,0 +1,179 @@
+/*
+ * File:   Search.cpp
+ * Author: matt
+ *
+ * Created on October 19, 2026
+ */
+
+#include "Search.h"
+#include "Card.h"
+
+static const uint32_t halfwidth[] = { // Katakana and punctuation for U+FF61 through U+FF9F
+	0x3002, 0x300C, 0x300D, 0x3001, 0x30FB, 0x30F2, 0x30A1, 0x30A3, 0x30A5, 0x30A7, 0x30A9, 0x30E3, 0x30E5, 0x30E7, 0x30C3, 0x30FC,
+	0x30A2, 0x30A4, 0x30A6, 0x30A8, 0x30AA, 0x30AB, 0x30AD, 0x30AF, 0x30B1, 0x30B3, 0x30B5, 0x30B7, 0x30B9, 0x30BB, 0x30BD, 0x30BF,
+	0x30C1, 0x30C4, 0x30C6, 0x30C8, 0x30CA, 0x30CB, 0x30CC, 0x30CD, 0x30CE, 0x30CF, 0x30D2, 0x30D5, 0x30D8, 0x30DB, 0x30DE, 0x30DF,
+	0x30E0, 0x30E1, 0x30E2, 0x30E4, 0x30E6, 0x30E8, 0x30E9, 0x30EA, 0x30EB, 0x30EC, 0x30ED, 0x30EF, 0x30F3, 0x309B, 0x309C
+};
+
+static bool voiceable(uint32_t c) // True if the katakana takes a dakuten as the next codepoint
+{
+	if (c >= 0x30AB && c <= 0x30C2) return c % 2 == 1;
+	if (c >= 0x30C4 && c <= 0x30C8) return c % 2 == 0;
+	if (c >= 0x30CF && c <= 0x30DB) return (c - 0x30CF) % 3 == 0;
+	return false;
+}
+
+std::string Search::normalize(std::string_view str)
+{
+	std::vector<uint32_t> cps{};
+	util::utf8_iter iter{str};
+	while (! iter.done())
+	{
+		uint32_t c = iter.next();
+		if (c >= 0xFF01 && c <= 0xFF5E) c -= 0xFEE0;
+		else if (c == 0x3000) c = ' ';
+		else if (c >= 0xFF61 && c <= 0xFF9F) c = halfwidth[c - 0xFF61];
+		if ((c == 0x309B || c == 0x309C) && ! cps.empty()) // Half-width voicing marks follow the kana they modify
+		{
+			uint32_t &prev = cps.back();
+			if (c == 0x309B && prev == 0x30A6) { prev = 0x30F4; continue; }
+			if (c == 0x309B && voiceable(prev)) { prev += 1; continue; }
+			if (c == 0x309C && prev >= 0x30CF && prev <= 0x30DB && (prev - 0x30CF) % 3 == 0) { prev += 2; continue; }
+		}
+		cps.push_back(c);
+	}
+	std::string ret{};
+	ret.reserve(str.size());
+	for (uint32_t c : cps)
+	{
+		if (c >= 0x30A1 && c <= 0x30F6) c -= 0x60;
+		else if (c == 0x30FD || c == 0x30FE) c -= 0x60;
+		if (c < 0x80) ret.push_back(static_cast<char>(c));
+		else ret.append(util::utf8_encode(c));
+	}
+	return ret;
+}
+
+std::string Search::text(const Card &card)
+{
+	std::string ret{};
+	for (const std::pair<const std::string, std::string> &field : card.fields()) ret.append(normalize(field.second)).push_back('\n');
+	if (card.hasfield("Expression") && card.hasfield("Reading")) ret.append(normalize(Card::hiragana(card.field("Expression"), card.field("Reading")))).push_back('\n');
+	return ret;
+}
+
+std::vector<uint64_t> Search::grams(const std::string &text)
+{
+	std::vector<uint64_t> ret{};
+	util::utf8_iter iter{text};
+	uint32_t prev = '\n';
+	while (! iter.done())
+	{
+		uint32_t c = iter.next();
+		if (c == '\n')
+		{
+			prev = c;
+			continue;
+		}
+		ret.push_back(key(c));
+		if (prev != '\n') ret.push_back(key(prev, c));
+		prev = c;
+	}
+	std::sort(ret.begin(), ret.end());
+	ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+	return ret;
+}
+
+void Search::add(Card *card, std::string &&text)
+{
+	int id = card->id();
+	std::unique_lock<std::shared_mutex> lock{lock_};
+	for (uint64_t gram : grams(text))
+	{
+		std::vector<int> &list = grams_[gram];
+		if (list.empty() || list.back() < id) list.push_back(id); // Cards are mostly added in ID order
+		else list.insert(std::lower_bound(list.begin(), list.end(), id), id);
+	}
+	cards_[id] = Entry{card, std::move(text)};
+}
+
+void Search::del(const Card *card)
+{
+	std::unique_lock<std::shared_mutex> lock{lock_};
+	std::unordered_map<int, Entry>::iterator entry = cards_.find(card->id());
+	if (entry == cards_.end()) return;
+	for (uint64_t gram : grams(entry->second.text))
+	{
+		std::unordered_map<uint64_t, std::vector<int>>::iterator iter = grams_.find(gram);
+		if (iter == grams_.end()) continue;
+		std::vector<int>::iterator pos = std::lower_bound(iter->second.begin(), iter->second.end(), card->id());
+		if (pos != iter->second.end() && *pos == card->id()) iter->second.erase(pos);
+		if (iter->second.empty()) grams_.erase(iter);
+	}
+	cards_.erase(entry);
+}
+
+Card *Search::card(int id) const
+{
+	std::shared_lock<std::shared_mutex> lock{lock_};
+	std::unordered_map<int, Entry>::const_iterator entry = cards_.find(id);
+	return entry == cards_.end() ? nullptr : entry->second.card;
+}
+
+std::vector<Card *> Search::find(std::string_view query) const
+{
+	std::vector<Card *> ret{};
+	std::vector<int> hits = ids(query);
+	std::shared_lock<std::shared_mutex> lock{lock_};
+	for (int id : hits) ret.push_back(cards_.at(id).card);
+	return ret;
+}
+
+std::vector<int> Search::ids(std::string_view query, const std::function<bool()> &stop) const
+{
+	std::vector<int> ret{};
+	const std::string norm = normalize(query);
+	if (norm.empty()) return ret;
+	std::vector<uint64_t> keys{};
+	util::utf8_iter iter{norm};
+	for (uint32_t prev = 0; ! iter.done(); )
+	{
+		uint32_t c = iter.next();
+		if (prev) keys.push_back(key(prev, c));
+		prev = c;
+	}
+	bool exact = keys.size() <= 1; // A single character or bigram is its own posting list; longer queries might only match piecewise
+	if (keys.empty()) keys.push_back(key(util::utf8_iter{norm}.next()));
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	std::shared_lock<std::shared_mutex> lock{lock_};
+	std::vector<const std::vector<int> *> lists{};
+	for (uint64_t k : keys)
+	{
+		std::unordered_map<uint64_t, std::vector<int>>::const_iterator list = grams_.find(k);
+		if (list == grams_.end()) return ret;
+		lists.push_back(&list->second);
+	}
+	std::sort(lists.begin(), lists.end(), [](const std::vector<int> *a, const std::vector<int> *b) { return a->size() < b->size(); });
+	std::vector<int> hits{*lists[0]};
+	for (std::size_t i = 1; i < lists.size() && ! hits.empty(); i++)
+	{
+		std::vector<int>::iterator out = hits.begin();
+		std::vector<int>::const_iterator pos = lists[i]->begin();
+		if (stop && stop()) return ret;
+		for (int id : hits)
+		{
+			pos = std::lower_bound(pos, lists[i]->end(), id); // The shorter list drives, binary searching the rest of the longer one
+			if (pos == lists[i]->end()) break;
+			if (*pos == id) *out++ = id;
+		}
+		hits.erase(out, hits.end());
+	}
+	if (exact) return hits;
+	for (std::size_t i = 0; i < hits.size(); i++)
+	{
+		if (i % 1024 == 0 && stop && stop()) break;
+		if (cards_.at(hits[i]).text.find(norm) != std::string::npos) ret.push_back(hits[i]);
+	}
+	return ret;
+}
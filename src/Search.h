@@ -0,0 +1,50 @@
+/*
+ * File:   Search.h
+ * Author: matt
+ *
+ * Created on October 19, 2026
+ */
+
+#ifndef SEARCH_H
+#define	SEARCH_H
+
+#include <unordered_map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <cstdint>
+
+class Card;
+
+class Search // Character and bigram index over the text of every card, so the browser can search as you type
+{
+private:
+	struct Entry
+	{
+		Card *card;
+		std::string text;
+	};
+	std::unordered_map<uint64_t, std::vector<int>> grams_; // Sorted IDs of the cards containing each character and each pair of adjacent characters
+	std::unordered_map<int, Entry> cards_;
+	mutable std::shared_mutex lock_; // Lets background searches read while the main thread edits
+	static uint64_t key(uint32_t a, uint32_t b = 0) { return (static_cast<uint64_t>(a) << 32) | b; }
+	static std::vector<uint64_t> grams(const std::string &text); // Each gram in the normalized text once, not spanning lines
+public:
+	static std::string normalize(std::string_view str); // Fold katakana to hiragana and full- and half-width forms to the usual ones
+	static std::string text(const Card &card); // Normalized fields and derived reading of the card, one per line
+	Search() : grams_{}, cards_{}, lock_{} { }
+
+	std::vector<int> ids(std::string_view query, const std::function<bool()> &stop = nullptr) const; // IDs of cards with any field or their reading containing the query, in order, or an incomplete list if stop() returns true; safe from any thread
+	std::vector<Card *> find(std::string_view query) const;
+	Card *card(int id) const; // Null if the card has been deleted
+	void add(Card *card, std::string &&text);
+	void add(Card *card) { add(card, text(*card)); }
+	void del(const Card *card);
+	void update(Card *card) { del(card); add(card); } // Call after any of the card's fields change
+};
+
+#endif	/* SEARCH_H */
+
@@ -8,30 +8,33 @@
 #include "Set.h"
 #include "Deck.h"
 
+std::vector<std::string> Set::customnames_{};
+
 const std::vector<Set::SetType> Set::settypes() { return std::vector<Set::SetType>{Set::SetType::NORMAL, Set::SetType::ALL, Set::SetType::KANJI, Set::SetType::KANA}; }
-std::unordered_map<Set::SetType, std::unordered_map<Set::DispType, std::unordered_set<std::vector<Card::Field>, Set::vfhash>, Set::dthash>, Set::sthash> Set::defdisp()
-{
-	return std::unordered_map<Set::SetType, std::unordered_map<Set::DispType, std::unordered_set<std::vector<Card::Field>, Set::vfhash>, Set::dthash>, Set::sthash> { // Your worst nightmare
-	{Set::SetType::NORMAL,
-		{{Set::DispType::FRONT, {{Card::Field::MEANING}, {Card::Field::FURIGANA}}},
-		{Set::DispType::BACK, {{Card::Field::FURIGANA, Card::Field::MEANING}}},
-		{Set::DispType::HINT, {{Card::Field::HIRAGANA}}}}},
-	{Set::SetType::ALL,
-		{{Set::DispType::FRONT, {{Card::Field::MEANING}, {Card::Field::FURIGANA}}},
-		{Set::DispType::BACK, {{Card::Field::FURIGANA, Card::Field::MEANING}}},
-		{Set::DispType::HINT, {{Card::Field::HIRAGANA}}}}},
-	{Set::SetType::KANJI,
-		{{Set::DispType::FRONT, {{Card::Field::MEANING}}},
-		{Set::DispType::BACK, {{Card::Field::FURIGANA, Card::Field::MEANING}}},
-		{Set::DispType::HINT, {{Card::Field::HIRAGANA}}}}},
-	{Set::SetType::KANA,
-		{{Set::DispType::FRONT, {{Card::Field::MEANING}, {Card::Field::FURIGANA}}},
-		{Set::DispType::BACK, {{Card::Field::FURIGANA, Card::Field::MEANING}}},
-		{Set::DispType::HINT, {{Card::Field::HIRAGANA}}}}}
+Set::SetType Set::custom(const std::string &name)
+{
+	for (SetType type : settypes()) if (st2str(type) == name) throw std::runtime_error{"Set name " + name + " is reserved"};
+	if (name == "" || name.find(':') != std::string::npos) throw std::runtime_error{"Invalid set name \"" + name + "\""};
+	std::vector<std::string>::iterator iter = std::find(customnames_.begin(), customnames_.end(), name);
+	if (iter == customnames_.end()) iter = customnames_.insert(customnames_.end(), name);
+	return static_cast<SetType>(static_cast<std::size_t>(SetType::CUSTOM) + (iter - customnames_.begin()));
+}
+
+std::unordered_map<Set::SetType, Set::Displays, Set::sthash> Set::defdisp()
+{
+	const Template *meaning = &Template::get("{meaning Meaning}");
+	const Template *furigana = &Template::get("{furigana Expression Reading}");
+	const Template *both = &Template::get("{furigana Expression Reading}\n{meaning Meaning}");
+	const Template *hiragana = &Template::get("{hiragana Expression Reading}");
+	return std::unordered_map<SetType, Displays, sthash>{
+		{SetType::NORMAL, {{DispType::FRONT, {meaning, furigana}}, {DispType::BACK, {both}}, {DispType::HINT, {hiragana}}}},
+		{SetType::ALL, {{DispType::FRONT, {meaning, furigana}}, {DispType::BACK, {both}}, {DispType::HINT, {hiragana}}}},
+		{SetType::KANJI, {{DispType::FRONT, {meaning}}, {DispType::BACK, {both}}, {DispType::HINT, {hiragana}}}},
+		{SetType::KANA, {{DispType::FRONT, {meaning, furigana}}, {DispType::BACK, {both}}, {DispType::HINT, {hiragana}}}}
 	};
 }
 
-Set::Set(Deck *deck, SetType type) : items_{}, repeats_{}, type_{type}, top_{nullptr}, deck_{deck}, displays_{deck->disp(type)}, curdisp_{} { deck_->build(); shuffle(); }
+Set::Set(Deck *deck, SetType type) : items_{}, repeats_{}, rand_{Deck::seed() ^ (static_cast<unsigned int>(deck->id()) * 0x9E3779B9u) ^ static_cast<unsigned int>(type)}, type_{type}, top_{nullptr}, deck_{deck}, displays_{deck->disp(type)}, curdisp_{}, slots_{this}, weights_{1}, repweights_{1}, slot_{-1} { deck_->build(); shuffle(); }
 
 std::string Set::canonical() const
 {
@@ -41,67 +44,108 @@ std::string Set::canonical() const
 void Set::clear()
 {
 	if (! top_) return;
-	for (Deck *d = top_->deck(); d != &Deck::root; d = d->parent()) d->set(type_).top_ = nullptr; // TODO Check
+	Deck *holder = top_->deck();
+	for (Deck *d = holder; d != &Deck::root && d->hasset(type_); d = d->parent()) d->set(type_).top_ = nullptr; // TODO Check
 	top_ = nullptr;
+	if (holder) holder->set(type_).refresh();
 }
 
-Card &Set::top()
+void Set::reindex()
 {
-	if (top_) return *top_;
-	std::vector<Set *> viable{};
-	if (items_.size() > 0) viable.push_back(this);
-	for (Deck *d : deck_->children()) if (d->set(type_).size(false) > 0) viable.push_back(&d->set(type_));
-	if (viable.size() == 0)
+	slots_.assign(1, this);
+	for (Deck *d : deck_->children()) if (d->hasset(type_)) slots_.push_back(&d->set(type_));
+	weights_.resize(slots_.size());
+	repweights_.resize(slots_.size());
+	for (unsigned int i = 1; i < slots_.size(); i++)
 	{
-		if (repeats_.size() > 0) viable.push_back(this);
-		for (Deck *d : deck_->children()) if (d->set(type_).size(true) > 0) viable.push_back(&d->set(type_));	
+		slots_[i]->slot_ = i;
+		weights_.set(i, slots_[i]->weights_.total());
+		repweights_.set(i, slots_[i]->repweights_.total());
 	}
-	Set *src = viable[rand() % viable.size()];
+	refresh();
+}
+
+void Set::refresh() // Recompute this set's own weights and push the new totals up through the ancestors' samplers
+{
+	weights_.set(0, items_.size() + ((top_ != nullptr && top_->deck() == deck_) ? 1 : 0));
+	repweights_.set(0, repeats_.size());
+	for (Set *s = this; s->slot_ > 0 && s->deck_->parent() && s->deck_->parent()->valid() && s->deck_->parent()->hasset(type_); )
+	{
+		Set &p = s->deck_->parent()->set(type_);
+		if (static_cast<unsigned int>(s->slot_) >= p.slots_.size() || p.slots_[s->slot_] != s) break; // Detached from a parent that has not been reindexed yet
+		p.weights_.set(s->slot_, s->weights_.total());
+		p.repweights_.set(s->slot_, s->repweights_.total());
+		s = &p;
+	}
+}
+
+Card &Set::top()
+{
+	if (top_) return *top_;
+	util::fenwick *weights = &weights_;
+	if (weights->total() == 0) weights = &repweights_; // Only fall back on repeats once no fresh cards remain anywhere below
+	if (weights->total() == 0) throw std::runtime_error{"Tried to get card out of empty deck"};
+	Set *src = slots_[weights->find(rand_() % weights->total())];
 	if (src == this)
 	{
 		if (src->items_.size() > 0) { top_ = src->items_.front(); src->items_.pop_front(); }
 		else if (src->repeats_.size() > 0) { top_ = src->repeats_.front(); src->repeats_.pop_front(); }
 		else throw std::runtime_error{"Tried to get card out of empty deck"};
+		refresh();
 	}
 	else top_ = &src->top();
-	for (std::pair<DispType, std::unordered_set<std::vector<Card::Field>, vfhash>> pair : displays_)
-	{
-		std::unordered_set<std::vector<Card::Field>, vfhash>::iterator iter = pair.second.begin();
-		std::advance(iter, rand() % pair.second.size());
-		curdisp_[pair.first] = *iter;
-	}
+	for (const std::pair<const DispType, std::vector<const Template *>> &pair : displays_) curdisp_[pair.first] = pair.second[rand_() % pair.second.size()];
 	return *top_;
 }
 
-std::string Set::disptop(DispType type)
+const Template &Set::topdisp(DispType type)
 {
-	Card &c_top = top();
-	return c_top.display(curdisp_.at(type));
+	top();
+	return *curdisp_.at(type);
 }
 
-void Set::shuffle()
+const std::vector<const Template *> &Set::displays(DispType type) const
 {
-	clear();
-	std::list<Card *> temp{};
-	while (items_.size())
-	{
-		temp.push_back(items_.front());
-		items_.pop_front();
-	}
-	while(temp.size())
+	static const std::vector<const Template *> none{};
+	Displays::const_iterator iter = displays_.find(type);
+	if (iter == displays_.end()) return none;
+	return iter->second;
+}
+
+std::vector<Card *> Set::upcoming(std::size_t n) const // Every slot deals from the front of its queue, so the next card is one of the fronts
+{
+	std::vector<Card *> ret{};
+	bool fresh = weights_.total() > 0; // Same fallback as top()
+	std::vector<const Set *> todo{this};
+	while (! todo.empty() && ret.size() < n)
 	{
-		std::list<Card *>::iterator iter = std::next(temp.begin(), rand() % temp.size());
-		items_.push_back(*iter);
-		temp.erase(iter);
+		const Set *s = todo.back();
+		todo.pop_back();
+		const std::deque<Card *> &queue = fresh ? s->items_ : s->repeats_;
+		if (! queue.empty()) ret.push_back(queue.front());
+		for (std::size_t i = 1; i < s->slots_.size(); i++) todo.push_back(s->slots_[i]);
 	}
+	return ret;
+}
+
+void Set::shuffle()
+{
+	clear();
+	std::shuffle(items_.begin(), items_.end(), rand_);
+}
+
+void Set::publish(std::deque<Card *> &&items, const std::default_random_engine &engine)
+{
+	clear();
+	items_ = std::move(items);
+	rand_ = engine;
+	refresh();
 }
 
 int Set::size(bool repeats) const
 {
-	int ret = items_.size();
-	if (repeats) ret += repeats_.size();
-	if (top_ != nullptr && top_->deck() == deck_) ret++;
-	for (Deck *d : deck_->children()) ret += d->set(type_).size(repeats);
+	int ret = weights_.total();
+	if (repeats) ret += repweights_.total();
 	//std::cout << "Set " << canonical() << " size " << ret << " top " << (top_ ? util::t2s(top_->id()) : "nil") << "\n\tItems:\n";
 	//for (Card *c : items_) std::cout << "\t\t" << c->id() << "\n";
 	//std::cout << "\tRepeats:\n";
@@ -116,18 +160,54 @@ void Set::remove(Card *card)
 	if (iter != items_.end())
 	{
 		items_.erase(iter);
+		refresh();
 		return;
 	}
 	iter = std::find(repeats_.begin(), repeats_.end(), card);
-	if (iter != repeats_.end()) repeats_.erase(iter);
+	if (iter != repeats_.end())
+	{
+		repeats_.erase(iter);
+		refresh();
+	}
+}
+
+bool Set::has(const Card *card) const
+{
+	return top_ == card || std::find(items_.begin(), items_.end(), card) != items_.end() || std::find(repeats_.begin(), repeats_.end(), card) != repeats_.end();
+}
+
+bool Set::take(Card *card, bool &repeat)
+{
+	std::deque<Card *>::iterator iter = std::find(items_.begin(), items_.end(), card);
+	if (iter != items_.end()) repeat = false;
+	else if ((iter = std::find(repeats_.begin(), repeats_.end(), card)) != repeats_.end()) repeat = true;
+	else return false;
+	if (repeat) repeats_.erase(iter);
+	else items_.erase(iter);
+	refresh();
+	return true;
+}
+
+void Set::give(Card *card, bool repeat)
+{
+	if (repeat) repeats_.push_back(card);
+	else items_.insert(items_.begin() + rand_() % (items_.size() + 1), card);
+	refresh();
 }
 
 void Set::update(Card::UpdateType ut)
 {
 	if (top_ == nullptr) throw std::runtime_error{"Tried to update inactive set"};
+	Notify::Batch batch{};
 	top_->update(ut);
 	if (type_ == SetType::KANJI) top_->deck()->bank().update(top_, ut);
-	if (ut == Card::UpdateType::BURY || top_->due(0)) top_->deck()->set(type_).repeats_.push_back(top_);
+	if (ut == Card::UpdateType::BURY || top_->due(0))
+	{
+		Set &home = top_->deck()->set(type_);
+		home.repeats_.push_back(top_);
+		home.refresh();
+	}
 	else for (std::unordered_map<Set::SetType, Set>::iterator iter = top_->deck()->sets().begin(); iter != top_->deck()->sets().end(); iter++) iter->second.remove(top_);
+	Notify::counts(top_->deck());
 	clear();
 }
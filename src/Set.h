@@ -12,23 +12,27 @@
 #include <unordered_set>
 #include <functional>
 #include <algorithm>
+#include <random>
 #include "Card.h"
+#include "Template.h"
 
 class Set
 {
 public:
-	enum class SetType { NORMAL = 0, ALL, KANJI, KANA }; // TODO Most recently missed, missed in the last n days, etc. // Ensure NORMAL is always first!
+	enum class SetType { NORMAL = 0, ALL, KANJI, KANA, CUSTOM = 0x100 }; // Ensure NORMAL is always first!  Types from CUSTOM up are user-defined sets, named in customnames_
 	enum class DispType { FRONT = 0, BACK, HINT };
 	struct sthash { size_t operator ()(const SetType &x) const { return static_cast<size_t>(x); } };
 	struct dthash { size_t operator ()(const DispType &x) const { return static_cast<size_t>(x); } };
-	struct vfhash { size_t operator ()(const std::vector<Card::Field> &x) const { size_t ret = 0; for (const Card::Field f : x) ret += static_cast<size_t>(f); return ret; } };
+	typedef std::unordered_map<DispType, std::vector<const Template *>, dthash> Displays; // Ways of showing each side, of which each card gets one at random
 	static const std::vector<SetType> settypes();
+	static SetType custom(const std::string &name); // Type for the user-defined set of this name, allocating one if needed
 	static std::string st2str(SetType type)
 	{
 		if (type == SetType::NORMAL) return "Normal";
 		if (type == SetType::ALL) return "All";
 		if (type == SetType::KANJI) return "Kanji";
 		if (type == SetType::KANA) return "Kana";
+		if (type >= SetType::CUSTOM && static_cast<std::size_t>(type) - static_cast<std::size_t>(SetType::CUSTOM) < customnames_.size()) return customnames_[static_cast<std::size_t>(type) - static_cast<std::size_t>(SetType::CUSTOM)];
 		throw std::runtime_error{"Impossible error in st2str"};
 	}
 	static SetType str2st(std::string str)
@@ -37,38 +41,54 @@ public:
 		if (str == "All") return SetType::ALL;
 		if (str == "Kanji") return SetType::KANJI;
 		if (str == "Kana") return SetType::KANA;
+		std::vector<std::string>::const_iterator iter = std::find(customnames_.begin(), customnames_.end(), str);
+		if (iter != customnames_.end()) return static_cast<SetType>(static_cast<std::size_t>(SetType::CUSTOM) + (iter - customnames_.begin()));
 		throw std::runtime_error{"Invalid string " + str + " passed to str2st"};
 	}
-	static std::unordered_map<SetType, std::unordered_map<DispType, std::unordered_set<std::vector<Card::Field>, vfhash>, dthash>, sthash> defdisp();
+	static std::unordered_map<SetType, Displays, sthash> defdisp();
 private:
+	static std::vector<std::string> customnames_;
 	std::deque<Card *> items_;
 	std::deque<Card *> repeats_;
+	std::default_random_engine rand_;
 	SetType type_;
 	Card *top_;
 	Deck *deck_;
-	std::unordered_map<DispType, std::unordered_set<std::vector<Card::Field>, vfhash>, dthash> displays_;
-	std::unordered_map<DispType, std::vector<Card::Field>, dthash> curdisp_;
+	Displays displays_;
+	std::unordered_map<DispType, const Template *, dthash> curdisp_;
+	std::vector<Set *> slots_; // This set followed by the corresponding sets of child decks
+	util::fenwick weights_; // Fresh cards available under each slot
+	util::fenwick repweights_; // Repeats available under each slot
+	int slot_; // Index of this set in the parent set's slots, or -1
 	void remove(Card *card);
 public:
 	Set() = delete;
 	Set(Deck *deck, SetType type);
 	Set (const Set &orig) = delete;
-	Set(Set &&orig) : items_{std::move(orig.items_)}, repeats_{orig.repeats_}, type_{orig.type_}, top_{orig.top_}, deck_{orig.deck_}, displays_{orig.displays_}, curdisp_{} { }
+	Set(Set &&orig) : items_{std::move(orig.items_)}, repeats_{orig.repeats_}, rand_{orig.rand_}, type_{orig.type_}, top_{orig.top_}, deck_{orig.deck_}, displays_{orig.displays_}, curdisp_{}, slots_{std::move(orig.slots_)}, weights_{std::move(orig.weights_)}, repweights_{std::move(orig.repweights_)}, slot_{orig.slot_} { slots_.at(0) = this; }
 	Set operator =(const Set& orig) = delete;
 	virtual ~Set() { }
 	
 	std::string canonical() const;
 	Deck &deck() const { return *deck_; }
+	SetType type() const { return type_; }
 	int size(bool repeats = true) const;
+	int own() const { return items_.size(); } // Fresh cards in this deck's own set, excluding subdecks
+	bool has(const Card *card) const; // Whether the card is waiting in or being studied from this set
 	Card &top();
-	std::string disptop(DispType type);
+	const Template &topdisp(DispType type); // Template chosen for showing this side of top()
+	const std::vector<const Template *> &displays(DispType type) const; // Every choice of template top() may make for this side
+	std::vector<Card *> upcoming(std::size_t n) const; // Up to n cards, one of which the next call to top() will pick
 	
 	void deck(Deck *d) { deck_ = d; }
+	void reindex();
 	void refresh();
-	void add(Card *card) { items_.push_back(card); }
-	void empty() { clear(); items_.clear(); }
+	std::default_random_engine engine() const { return rand_; }
+	void publish(std::deque<Card *> &&items, const std::default_random_engine &engine); // Install contents prepared (and shuffled with a copy of this set's engine) by Deck
 	void shuffle();
 	void clear();
+	bool take(Card *card, bool &repeat); // Remove a waiting card, noting whether it was a repeat; false if it was not there
+	void give(Card *card, bool repeat); // Insert a card without disturbing the order of the others
 	void update(Card::UpdateType ut);
 };
 
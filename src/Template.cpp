@@ -0,0 +1,119 @@
+/*
+ * File:   Template.cpp
+ * Author: matt
+ *
+ * Created on October 19, 2026
+ */
+
+#include "Template.h"
+
+std::unordered_map<std::string, std::unique_ptr<const Template>> &Template::templates()
+{
+	static std::unordered_map<std::string, std::unique_ptr<const Template>> ret{}; // Local, since decks compile their templates during static initialization
+	return ret;
+}
+
+const Template &Template::get(const std::string &source)
+{
+	std::unique_ptr<const Template> &ret = templates()[source];
+	if (! ret) ret.reset(new Template{source});
+	return *ret;
+}
+
+Template::Template(const std::string &source) : source_{source}, code_{}, blocks_{0}
+{
+	std::string::size_type pos = 0;
+	do // One block for each line, ignoring a final newline
+	{
+		std::string::size_type end = source.find('\n', pos);
+		if (end == std::string::npos) end = source.size();
+		std::size_t block = code_.size();
+		code_.push_back(Instr{Op::BLOCK, Card::Field::NONE, -1, -1, {}});
+		blocks_++;
+		Card::Field style = Card::Field::NONE;
+		while (pos < end)
+		{
+			std::string::size_type open = std::min(source.find('{', pos), end);
+			if (open > pos)
+			{
+				code_.push_back(Instr{Op::TEXT, Card::Field::NONE, -1, -1, {}});
+				Card::words(std::string_view{source}.substr(pos, open - pos), code_.back().text);
+			}
+			if (open == end) break;
+			std::string::size_type close = source.find('}', open);
+			if (close == std::string::npos || close > end) throw std::runtime_error{"Unterminated directive in template \"" + source + "\""};
+			directive(source.substr(open + 1, close - open - 1), style);
+			pos = close + 1;
+		}
+		code_[block].style = style;
+		pos = end + 1;
+	} while (pos < source.size());
+}
+
+void Template::directive(const std::string &dir, Card::Field &style)
+{
+	std::vector<std::string> args{};
+	std::istringstream stream{dir};
+	for (std::string arg; stream >> arg; ) args.push_back(arg);
+	if (args.size() == 1) code_.push_back(Instr{Op::FIELD, Card::Field::NONE, Card::fieldid(args[0]), -1, {}});
+	else if (args.size() == 2 && args[0] == "kanji")
+	{
+		code_.push_back(Instr{Op::RUBY, Card::Field::NONE, Card::fieldid(args[1]), -1, {}});
+		style = Card::Field::KANJI;
+	}
+	else if (args.size() == 2 && args[0] == "meaning")
+	{
+		code_.push_back(Instr{Op::FIELD, Card::Field::NONE, Card::fieldid(args[1]), -1, {}});
+		style = Card::Field::MEANING;
+	}
+	else if (args.size() == 3 && args[0] == "furigana")
+	{
+		code_.push_back(Instr{Op::RUBY, Card::Field::NONE, Card::fieldid(args[1]), Card::fieldid(args[2]), {}});
+		style = Card::Field::FURIGANA;
+	}
+	else if (args.size() == 3 && args[0] == "hiragana")
+	{
+		code_.push_back(Instr{Op::KANA, Card::Field::NONE, Card::fieldid(args[1]), Card::fieldid(args[2]), {}});
+		style = Card::Field::HIRAGANA;
+	}
+	else throw std::runtime_error{"Invalid directive \"{" + dir + "}\" in template \"" + source_ + "\""};
+}
+
+void Template::render(const std::vector<const std::string *> &fields, std::vector<Card::Block> &out) const
+{
+	static const std::string none{};
+	auto field = [&fields](int id) -> const std::string & { return id >= 0 && static_cast<std::size_t>(id) < fields.size() && fields[id] ? *fields[id] : none; };
+	out.reserve(out.size() + blocks_);
+	for (const Instr &in : code_)
+	{
+		if (in.op == Op::BLOCK)
+		{
+			out.push_back(Card::Block{in.style, {}});
+			continue;
+		}
+		std::vector<Card::Ruby> &runs = out.back().runs;
+		std::size_t first = runs.size();
+		switch (in.op)
+		{
+			case Op::TEXT:
+				runs.insert(runs.end(), in.text.begin(), in.text.end());
+				break;
+			case Op::FIELD:
+				Card::words(field(in.field), runs);
+				break;
+			case Op::RUBY:
+				Card::ruby(field(in.field), field(in.reading), runs);
+				break;
+			case Op::KANA: // Each group written as its reading, which breaks lines only between groups, like furigana does
+				Card::ruby(field(in.field), field(in.reading), runs);
+				for (std::size_t i = first; i < runs.size(); i++) if (runs[i].reading != "")
+				{
+					runs[i].base = std::move(runs[i].reading);
+					runs[i].reading.clear();
+				}
+				break;
+			default:
+				break;
+		}
+	}
+}
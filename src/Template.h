@@ -0,0 +1,63 @@
+/*
+ * File:   Template.h
+ * Author: matt
+ *
+ * Created on October 19, 2026
+ */
+
+#ifndef TEMPLATE_H
+#define	TEMPLATE_H
+
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include "Card.h"
+
+/*
+ * How one side of a card is laid out for study.  The source is text with directives in braces, and each line of it
+ * becomes one block of the card:
+ *
+ *	{field}                   the field's text
+ *	{kanji field}             the field in large type
+ *	{furigana field reading}  the field with the furigana in reading, comma-separated as for Card::ruby, set over it
+ *	{hiragana field reading}  the reading written out, keeping the field's own characters where it has none
+ *	{meaning field}           the field in bold
+ *
+ * where field and reading are card field names.  A line is drawn in the style of the last helper on it, and other
+ * text on the line is shown as written.  For example, the usual back of a card is
+ * "{furigana Expression Reading}\n{meaning Meaning}".
+ *
+ * Each distinct source is compiled once into a flat program with its field names resolved to Card::fieldid() and its
+ * literal text already broken into runs, so rendering a card only indexes its slots() and appends to the output.
+ */
+class Template
+{
+private:
+	enum class Op { BLOCK, TEXT, FIELD, RUBY, KANA };
+	struct Instr
+	{
+		Op op;
+		Card::Field style; // For BLOCK
+		int field, reading; // Card::fieldid()s, or -1 for none
+		std::vector<Card::Ruby> text; // For TEXT
+	};
+	static std::unordered_map<std::string, std::unique_ptr<const Template>> &templates();
+
+	std::string source_;
+	std::vector<Instr> code_;
+	std::size_t blocks_;
+	Template(const std::string &source);
+	void directive(const std::string &dir, Card::Field &style);
+public:
+	static const Template &get(const std::string &source); // Compiled on first use and kept, so templates can be compared by address; main thread only
+	Template() = delete;
+	Template(const Template &orig) = delete;
+
+	const std::string &source() const { return source_; }
+	void render(const std::vector<const std::string *> &fields, std::vector<Card::Block> &out) const; // Append the blocks shown for a card with these Card::slots(); safe from any thread
+};
+
+#endif	/* TEMPLATE_H */
+
@@ -0,0 +1,160 @@
+/*
+ * File:   Watchdog.cpp
+ * Author: matt
+ *
+ * Created on October 19, 2026
+ */
+
+#include "Watchdog.h"
+
+std::thread::id Watchdog::main_{};
+Watchdog::Clock::duration Watchdog::budget_{};
+std::array<Watchdog::Clock::duration, 3> Watchdog::totals_{};
+Watchdog::Part Watchdog::part_ = Watchdog::Part::WIDGET;
+Watchdog::Clock::time_point Watchdog::mark_{};
+std::vector<const Watchdog::Handler *> Watchdog::stack_{};
+std::atomic<const char *> Watchdog::where_{nullptr};
+std::atomic<Watchdog::Clock::rep> Watchdog::beat_{0};
+std::mutex Watchdog::lock_{};
+std::condition_variable Watchdog::wake_{};
+bool Watchdog::stop_ = false;
+std::string Watchdog::path_{};
+std::ofstream Watchdog::log_{};
+std::function<void(const std::string &)> Watchdog::listener_{};
+std::thread Watchdog::thread_{};
+static struct Stopper { ~Stopper() { Watchdog::stop(); } } stopper{}; // Destroyed before the members above, so the thread is never left running
+
+Watchdog::Handler::Handler(const char *name, int mode) : name_{name}, mode_{mode}, active_{active()}, outer_{Part::WIDGET}, start_{}, totals_{}
+{
+	if (! active_) return;
+	outer_ = switchto(Part::WIDGET);
+	start_ = mark_;
+	totals_ = Watchdog::totals_;
+	stack_.push_back(this);
+	where_ = name_;
+}
+
+Watchdog::Handler::~Handler()
+{
+	if (! active_) return;
+	switchto(outer_);
+	stack_.pop_back();
+	where_ = stack_.empty() ? nullptr : stack_.back()->name_;
+	Clock::duration total = mark_ - start_;
+	if (total < budget_) return;
+	std::ostringstream msg{};
+	for (const Handler *outer : stack_) msg << outer->label() << " > ";
+	msg << label() << " took " << ms(total) << " ms (model " << ms(Watchdog::totals_[0] - totals_[0]) << ", backend " << ms(Watchdog::totals_[1] - totals_[1]) << ", widget " << ms(Watchdog::totals_[2] - totals_[2]) << ")";
+	std::unique_lock<std::mutex> lock{lock_};
+	write(msg.str());
+}
+
+std::string Watchdog::Handler::label() const
+{
+	if (mode_ < 0) return name_;
+	std::ostringstream ret{};
+	ret << name_ << "(0x" << std::hex << mode_ << ")";
+	return ret.str();
+}
+
+Watchdog::Phase::Phase(Part part) : outer_{Part::WIDGET}, active_{active()}
+{
+	if (active_) outer_ = switchto(part);
+}
+
+Watchdog::Phase::~Phase()
+{
+	if (active_) switchto(outer_);
+}
+
+Watchdog::Part Watchdog::switchto(Part part)
+{
+	Clock::time_point now = Clock::now();
+	totals_[static_cast<int>(part_)] += now - mark_;
+	mark_ = now;
+	Part ret = part_;
+	part_ = part;
+	return ret;
+}
+
+void Watchdog::database(Clock::duration time)
+{
+	if (! active()) return;
+	totals_[static_cast<int>(Part::BACKEND)] += time;
+	totals_[static_cast<int>(part_)] -= time; // It ran during the current part, which is charged when the part ends
+}
+
+void Watchdog::write(const std::string &msg)
+{
+	char stamp[32];
+	std::time_t now = std::time(nullptr);
+	std::tm local{};
+	std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime_r(&now, &local));
+	std::string line = std::string{stamp} + "  " + msg;
+	if (log_.is_open())
+	{
+		log_ << line << std::endl;
+		if (log_.tellp() > rotate_)
+		{
+			log_.close();
+			std::rename(path_.c_str(), (path_ + ".1").c_str());
+			log_.open(path_, std::ios::app);
+		}
+	}
+	if (listener_) listener_(line);
+}
+
+void Watchdog::watch()
+{
+	std::unique_lock<std::mutex> lock{lock_};
+	Clock::rep stalled = 0; // Time of the last beat before the current stall, if any
+	while (! wake_.wait_for(lock, check_, []() { return stop_; }))
+	{
+		Clock::rep last = beat_;
+		Clock::duration silent = Clock::now() - Clock::time_point{Clock::duration{last}};
+		if (! stalled && silent >= stall_)
+		{
+			const char *where = where_;
+			write("Event loop stalled for " + std::to_string(ms(silent)) + " ms so far, in " + (where ? where : "no handler"));
+			stalled = last;
+		}
+		else if (stalled && last != stalled)
+		{
+			write("Event loop resumed after " + std::to_string(ms(Clock::duration{last - stalled})) + " ms");
+			stalled = 0;
+		}
+	}
+}
+
+void Watchdog::start(const std::string &path, int budget)
+{
+	stop();
+	main_ = std::this_thread::get_id();
+	budget_ = std::chrono::milliseconds{budget};
+	mark_ = Clock::now();
+	beat();
+	std::unique_lock<std::mutex> lock{lock_};
+	stop_ = false;
+	path_ = path;
+	log_.open(path_, std::ios::app);
+	thread_ = std::thread{watch};
+}
+
+void Watchdog::stop()
+{
+	{
+		std::unique_lock<std::mutex> lock{lock_};
+		stop_ = true;
+	}
+	wake_.notify_all();
+	if (thread_.joinable()) thread_.join();
+	std::unique_lock<std::mutex> lock{lock_};
+	if (log_.is_open()) log_.close();
+	main_ = std::thread::id{};
+}
+
+void Watchdog::listen(const std::function<void(const std::string &)> &listener)
+{
+	std::unique_lock<std::mutex> lock{lock_};
+	listener_ = listener;
+}
@@ -0,0 +1,98 @@
+/*
+ * File:   Watchdog.h
+ * Author: matt
+ *
+ * Created on October 19, 2026
+ */
+
+#ifndef WATCHDOG_H
+#define	WATCHDOG_H
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <functional>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/*
+ * Finds out what freezes the interface.  Each event handler holds a Handler while it runs, and any that takes longer
+ * than the budget is logged with its time split into model, backend and widget time.  Model time is spent inside a
+ * Phase in the model code, backend time is what SQLite reports for each statement as it finishes, and the rest is
+ * widget time, which is mostly wx.  A thread of its own also logs when the event loop stops calling beat(), which
+ * catches hangs that never return and those outside any handler.
+ *
+ * Lines go to a log file, which is rotated once it passes a megabyte, and to the listener, which may be called from
+ * either thread.  Handler, Phase and database() only do anything on the thread that called start().
+ */
+class Watchdog
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+	enum class Part { MODEL, BACKEND, WIDGET };
+	class Handler
+	{
+	private:
+		const char *name_;
+		int mode_;
+		bool active_;
+		Part outer_; // The part the enclosing code was in
+		Clock::time_point start_;
+		std::array<Clock::duration, 3> totals_; // Watchdog::totals_ when started
+		std::string label() const;
+	public:
+		Handler(const char *name, int mode = -1); // The name must be a literal.  A mode is logged in hex, as for refresh_views().
+		Handler(const Handler &orig) = delete;
+		~Handler();
+	};
+	class Phase // Count the time until destruction as this part, nesting within other phases
+	{
+	private:
+		Part outer_;
+		bool active_;
+	public:
+		Phase(Part part);
+		Phase(const Phase &orig) = delete;
+		~Phase();
+	};
+private:
+	static constexpr std::chrono::milliseconds stall_{1000}; // Silence from the event loop for this long is a stall
+	static constexpr std::chrono::milliseconds check_{250};
+	static const std::streamoff rotate_ = 1 << 20;
+	static std::thread::id main_;
+	static Clock::duration budget_;
+	static std::array<Clock::duration, 3> totals_; // Time in each part so far, up to mark_
+	static Part part_;
+	static Clock::time_point mark_;
+	static std::vector<const Handler *> stack_; // Handlers running, outermost first
+	static std::atomic<const char *> where_; // Name of the innermost, for the watching thread
+	static std::atomic<Clock::rep> beat_;
+	static std::mutex lock_; // For everything from here down
+	static std::condition_variable wake_;
+	static bool stop_;
+	static std::string path_;
+	static std::ofstream log_;
+	static std::function<void(const std::string &)> listener_;
+	static std::thread thread_;
+	static bool active() { return std::this_thread::get_id() == main_; }
+	static Part switchto(Part part); // Returns the part that was current
+	static void write(const std::string &msg); // Call with lock_ held
+	static void watch();
+	static long long ms(Clock::duration d) { return std::chrono::duration_cast<std::chrono::milliseconds>(d).count(); }
+public:
+	static void start(const std::string &path, int budget); // Budget in milliseconds; call from the main thread once the event loop is about to run
+	static void stop();
+	static void listen(const std::function<void(const std::string &)> &listener);
+	static void beat() { beat_ = Clock::now().time_since_epoch().count(); } // Call regularly from the event loop; safe from any thread
+	static void database(Clock::duration time); // Time SQLite spent on a statement
+};
+
+#endif	/* WATCHDOG_H */
+
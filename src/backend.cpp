@@ -9,11 +9,14 @@
 #include "Bank.h"
 #include "Card.h"
 #include "Deck.h"
+#include "Watchdog.h"
 
 namespace backend
 {
 	std::string deckfname{};
 	sqlite3 *db = nullptr;
+	int transac_depth = 0; // Nested transactions join the outermost one
+	const std::string filter_schema{"CREATE TABLE IF NOT EXISTS \"filter\" ( `deck` TEXT NOT NULL, `name` TEXT NOT NULL, `expr` TEXT NOT NULL, PRIMARY KEY(deck,name), FOREIGN KEY(`deck`) REFERENCES deck ( name ) )"}; // Also created by upgrade()
 	
 	std::time_t midnight()
 	{
@@ -29,11 +32,10 @@ namespace backend
 		db = nullptr;
 	}
 	
-	std::string deckfile()
+	std::string confdir()
 	{
 		std::string pathsep{"/"};
 		std::string confdir{"tango"};
-		std::string confdb{"decks.db"};
 		std::string confbase{};
 		char *confhome = getenv("XDG_CONFIG_HOME");
 		if (confhome) confbase = confhome;
@@ -43,7 +45,12 @@ namespace backend
 			confbase = std::string{home} + pathsep + ".config";
 			// TODO If .config doesn't exit, then use ~/.tango instead
 		}
-		return confbase + pathsep + confdir + pathsep + confdb;
+		return confbase + pathsep + confdir;
+	}
+	
+	std::string deckfile()
+	{
+		return confdir() + "/decks.db";
 	}
 	
 	void batch(const std::vector<std::string> &args) try
@@ -59,6 +66,34 @@ namespace backend
 				exit(0);
 			}
 		}
+		else if (args[2] == "forecast") // forecast [steps] [reviews]
+		{
+			int steps = args.size() > 3 ? util::s2t<int>(args[3]) : 14;
+			bool reviews = args.size() > 4 && args[4] == "reviews";
+			if (steps <= 0) throw std::runtime_error{"Forecast requires a positive number of steps"};
+			early_populate();
+			populate();
+			std::unordered_map<const Deck *, std::vector<int>> forecast = Deck::forecast(steps, reviews);
+			std::vector<const Deck *> decks{&Deck::root};
+			for (const Deck &d : Deck::decks()) decks.push_back(&d);
+			std::sort(decks.begin() + 1, decks.end(), [](const Deck *a, const Deck *b) { return a->canonical() < b->canonical(); });
+			for (const Deck *d : decks)
+			{
+				std::cout << (d == &Deck::root ? "*" : d->canonical());
+				for (int n : forecast.at(d)) std::cout << "\t" << n;
+				std::cout << "\n";
+			}
+			exit(0);
+		}
+		else if (args[2] == "shift") // shift deck steps
+		{
+			if (args.size() < 5) throw std::runtime_error{"Shift requires a deck and a number of steps"};
+			early_populate();
+			populate();
+			if (! Deck::exists(args[3])) throw std::runtime_error{"No deck named " + args[3]};
+			Deck::get(args[3]).shift(util::s2t<int>(args[4]));
+			exit(0);
+		}
 		else throw std::runtime_error{"Unknown batch operation " + args[2]};
 		exit(0); // TODO Probably the wrong way to do this
 	}
@@ -82,6 +117,7 @@ namespace backend
 		deckfname = deckfile();
 		if (! util::file_exists(deckfname)) db_setup(deckfname);
 		checksql(sqlite3_open(deckfname.c_str(), &db), "Couldn't open deck database");
+		sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, [](unsigned int, void *, void *, void *ns) { Watchdog::database(std::chrono::nanoseconds{*static_cast<sqlite3_int64 *>(ns)}); return 0; }, nullptr); // Backend time for the watchdog
 		if (args.size() > 1)
 		{
 			if (args[1] == "batch") batch(args);
@@ -102,9 +138,10 @@ namespace backend
 			"CREATE TABLE \"card\" ( `id` INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, `deck` TEXT NOT NULL, `step` INTEGER NOT NULL DEFAULT 1, `interval` INTEGER NOT NULL DEFAULT 0, `status` INTEGER, `upd_norm` INTEGER NOT NULL DEFAULT 0, `upd_decr` INTEGER NOT NULL DEFAULT 0, `upd_incr` INTEGER NOT NULL DEFAULT 0, `upd_reset` INTEGER NOT NULL DEFAULT 0 )",
 			"CREATE TABLE \"character\" ( `deck` TEXT NOT NULL, `category` TEXT, `character` TEXT NOT NULL, `active` INTEGER NOT NULL, `step` INTEGER, `count` INTEGER NOT NULL DEFAULT 0, PRIMARY KEY(deck,character), FOREIGN KEY(`deck`) REFERENCES deck ( id ), FOREIGN KEY(`category`) REFERENCES kanji_category ( name ) )",
 			"CREATE TABLE \"character_category\" ( `deck` TEXT NOT NULL, `name` TEXT NOT NULL, PRIMARY KEY(deck,name) )",
-			"CREATE TABLE \"deck\" ( `name` TEXT NOT NULL, PRIMARY KEY(name) )",
+			"CREATE TABLE \"deck\" ( `name` TEXT NOT NULL, `epoch` INTEGER NOT NULL DEFAULT 0, PRIMARY KEY(name) )",
 			"CREATE TABLE \"field\" ( `card` INTEGER NOT NULL, `field` TEXT NOT NULL, `value` TEXT, PRIMARY KEY(card,field), FOREIGN KEY(card) REFERENCES card(id), FOREIGN KEY(field) REFERENCES field(id) )",
-			"CREATE TABLE \"fieldname\" ( `name` TEXT NOT NULL, PRIMARY KEY(name) )"
+			"CREATE TABLE \"fieldname\" ( `name` TEXT NOT NULL, PRIMARY KEY(name) )",
+			filter_schema
 		};
 		std::vector<std::string> fieldnames{"Expression", "Reading", "Meaning"};
 		std::unordered_map<std::string, std::vector<std::string>> characters{
@@ -155,10 +192,16 @@ namespace backend
 		if (db == nullptr) throw std::runtime_error{"Database connection unexpectedly closed"};
 		// TODO Check if DB is locked for editing
 		
-		checksql(sqlite3_prepare_v2(db, "select `name` from `deck`", -1, &stmt, nullptr), "Failed to fetch deck names");
-		while (sqlite3_step(stmt) == SQLITE_ROW) Deck::add(std::string{(const char *) sqlite3_column_text(stmt, 0)});
+		checksql(sqlite3_prepare_v2(db, "select `name`, `epoch` from `deck`", -1, &stmt, nullptr), "Failed to fetch deck names");
+		while (sqlite3_step(stmt) == SQLITE_ROW) Deck::add(std::string{(const char *) sqlite3_column_text(stmt, 0)}).epoch(sqlite3_column_int(stmt, 1));
 		sqlite3_finalize(stmt);
 		
+		std::map<std::string, std::map<std::string, std::string>> filters{};
+		checksql(sqlite3_prepare_v2(db, "select `deck`, `name`, `expr` from `filter`", -1, &stmt, nullptr), "Failed to fetch set filters");
+		while (sqlite3_step(stmt) == SQLITE_ROW) filters[std::string{(const char *) sqlite3_column_text(stmt, 0)}][std::string{(const char *) sqlite3_column_text(stmt, 1)}] = std::string{(const char *) sqlite3_column_text(stmt, 2)};
+		sqlite3_finalize(stmt);
+		for (const std::pair<const std::string, std::map<std::string, std::string>> &deck : filters) Deck::get(deck.first).filters(deck.second, true);
+		
 		checksql(sqlite3_prepare_v2(db, "select `id`, `deck`, `step`, `interval`, `status`, `upd_norm`, `upd_decr`, `upd_incr`, `upd_reset` from `card`", -1, &stmt, nullptr), "Failed to fetch cards");
 		while (sqlite3_step(stmt) == SQLITE_ROW)
 		{
@@ -207,9 +250,27 @@ namespace backend
 		}
 		sqlite3_finalize(stmt);
 		//for (const Card &card : Card::cards()) for (std::string field : Card::fieldnames()) if (! card.hasfield(field)) throw std::runtime_error{"Card " + util::t2s(card.id()) + " missing field " + field};
+		Card::cache_all();
 		Deck::rebuild_all();
 	}
 	
+	void upgrade(int from)
+	{
+		transac_begin();
+		sqlite3_stmt *stmt;
+		if (from < 3) // Each change is skipped if already made, since some version 2 databases were written by builds that had them
+		{
+			if (sqlite3_prepare_v2(db, "select `epoch` from `deck`", -1, &stmt, nullptr) != SQLITE_OK) checksql(sqlite3_exec(db, "alter table `deck` add column `epoch` INTEGER NOT NULL DEFAULT 0", 0, 0, 0), "Failed to add deck epochs"); // Version 2 stored absolute steps, which is the same as an epoch of 0
+			sqlite3_finalize(stmt);
+			checksql(sqlite3_exec(db, filter_schema.c_str(), 0, 0, 0), "Failed to set up set filters");
+		}
+		checksql(sqlite3_prepare_v2(db, "update `info` set `version` = ?", -1, &stmt, nullptr), "Failed to update database version");
+		checksql(sqlite3_bind_int(stmt, 1, db_version));
+		checksql(sqlite3_step(stmt));
+		sqlite3_finalize(stmt);
+		transac_end();
+	}
+	
 	void early_populate()
 	{
 		sqlite3_stmt *stmt;
@@ -218,6 +279,14 @@ namespace backend
 		checksql(sqlite3_prepare_v2(db, "select `version`, `step`, `laststep` from `info`", -1, &stmt, nullptr), "Failed to verify database version");
 		if (sqlite3_step(stmt) != SQLITE_ROW) throw std::runtime_error{"Failed to verify database version"};
 		int ver = sqlite3_column_int(stmt, 0);
+		if (ver >= 2 && ver < db_version)
+		{
+			sqlite3_finalize(stmt);
+			upgrade(ver);
+			checksql(sqlite3_prepare_v2(db, "select `version`, `step`, `laststep` from `info`", -1, &stmt, nullptr), "Failed to verify database version");
+			if (sqlite3_step(stmt) != SQLITE_ROW) throw std::runtime_error{"Failed to verify database version"};
+			ver = sqlite3_column_int(stmt, 0);
+		}
 		if (ver != db_version) throw std::runtime_error{"Program requires database of version " + util::t2s(db_version) + ", but current database is version " + util::t2s(ver)};
 		Deck::curstep = sqlite3_column_int(stmt, 1);
 		std::time_t laststep = sqlite3_column_int(stmt, 2);
@@ -254,12 +323,13 @@ namespace backend
 	
 	void transac_begin()
 	{
-		checksql(sqlite3_exec(db, "begin", 0, 0, 0));
+		if (transac_depth == 0) checksql(sqlite3_exec(db, "begin", 0, 0, 0));
+		transac_depth++;
 	}
 	
 	void transac_end()
 	{
-		checksql(sqlite3_exec(db, "commit", 0, 0, 0));
+		if (--transac_depth == 0) checksql(sqlite3_exec(db, "commit", 0, 0, 0));
 	}
 	
 	void card_update(const Card &card)
@@ -339,7 +409,11 @@ namespace backend
 		if (sqlite3_step(stmt) != SQLITE_ROW) newdeck = true;
 		sqlite3_finalize(stmt);
 		
-		if (newdeck) checksql(sqlite3_prepare_v2(db, "insert into `deck` (`name`) values (?)", -1, &stmt, nullptr));
+		if (newdeck)
+		{
+			checksql(sqlite3_prepare_v2(db, "insert into `deck` (`name`, `epoch`) values (?, ?)", -1, &stmt, nullptr));
+			checksql(sqlite3_bind_int(stmt, 2, deck.epoch()));
+		}
 		else
 		{
 			checksql(sqlite3_prepare_v2(db, "update `deck` set `name` = ? where `name` = ?", -1, &stmt, nullptr));
@@ -348,6 +422,16 @@ namespace backend
 		checksql(sqlite3_bind_text(stmt, 1, deck.canonical().c_str(), -1, nullptr));
 		checksql(sqlite3_step(stmt));
 		sqlite3_finalize(stmt);
+		
+		std::string newname{deck.canonical()};
+		if (! newdeck && name != newname)
+		{
+			checksql(sqlite3_prepare_v2(db, "update `filter` set `deck` = ? where `deck` = ?", -1, &stmt, nullptr));
+			checksql(sqlite3_bind_text(stmt, 1, newname.c_str(), -1, nullptr));
+			checksql(sqlite3_bind_text(stmt, 2, name.c_str(), -1, nullptr));
+			checksql(sqlite3_step(stmt));
+			sqlite3_finalize(stmt);
+		}
 	}
 	
 	void deck_del(const Deck &deck)
@@ -359,30 +443,74 @@ namespace backend
 		checksql(sqlite3_bind_text(stmt, 1, deck.canonical().c_str(), -1, nullptr));
 		checksql(sqlite3_step(stmt));
 		sqlite3_finalize(stmt);
+		
+		std::string name{deck.canonical()};
+		checksql(sqlite3_prepare_v2(db, "delete from `filter` where `deck` = ?", -1, &stmt, nullptr));
+		checksql(sqlite3_bind_text(stmt, 1, name.c_str(), -1, nullptr));
+		checksql(sqlite3_step(stmt));
+		sqlite3_finalize(stmt);
 	}
 	
-	void bank_edit(const Deck &deck, const std::string &character, bool active, int step, int count, std::string olddeck)
+	void deck_filters(const Deck &deck)
 	{
-		//std::cout << "Update " << character << " in deck " << deck.canonical() << " from deck " << olddeck << " to active = " << active << ", step = " << step << ", count = " << count << "\n";
 		sqlite3_stmt *stmt;
 		if (db == nullptr) throw std::runtime_error{"Database connection unexpectedly closed"};
 		
-		if (olddeck != "" && olddeck != deck.canonical())
+		std::string name{deck.canonical()};
+		transac_begin();
+		checksql(sqlite3_prepare_v2(db, "delete from `filter` where `deck` = ?", -1, &stmt, nullptr));
+		checksql(sqlite3_bind_text(stmt, 1, name.c_str(), -1, nullptr));
+		checksql(sqlite3_step(stmt));
+		sqlite3_finalize(stmt);
+		for (const std::pair<const Set::SetType, std::shared_ptr<const Filter>> &filter : deck.ownfilters())
 		{
-			std::string newname{deck.canonical()};
-			
-			checksql(sqlite3_prepare_v2(db, "update `character` set `deck` = ? where `deck` = ?", -1, &stmt, nullptr));
-			checksql(sqlite3_bind_text(stmt, 1, newname.c_str(), -1, nullptr));
-			checksql(sqlite3_bind_text(stmt, 2, olddeck.c_str(), -1, nullptr));
+			std::string setname{Set::st2str(filter.first)};
+			checksql(sqlite3_prepare_v2(db, "insert into `filter` (`deck`, `name`, `expr`) values (?, ?, ?)", -1, &stmt, nullptr));
+			checksql(sqlite3_bind_text(stmt, 1, name.c_str(), -1, nullptr));
+			checksql(sqlite3_bind_text(stmt, 2, setname.c_str(), -1, nullptr));
+			checksql(sqlite3_bind_text(stmt, 3, filter.second->expr().c_str(), -1, nullptr));
 			checksql(sqlite3_step(stmt));
 			sqlite3_finalize(stmt);
-
-			checksql(sqlite3_prepare_v2(db, "update `character_category` set `deck` = ? where `deck` = ?", -1, &stmt, nullptr));
-			checksql(sqlite3_bind_text(stmt, 1, newname.c_str(), -1, nullptr));
-			checksql(sqlite3_bind_text(stmt, 2, olddeck.c_str(), -1, nullptr));
+		}
+		transac_end();
+	}
+	
+	void deck_epoch(const Deck &deck)
+	{
+		sqlite3_stmt *stmt;
+		if (db == nullptr) throw std::runtime_error{"Database connection unexpectedly closed"};
+		
+		std::string name{deck.canonical()};
+		checksql(sqlite3_prepare_v2(db, "update `deck` set `epoch` = ? where `name` = ?", -1, &stmt, nullptr));
+		checksql(sqlite3_bind_int(stmt, 1, deck.epoch()));
+		checksql(sqlite3_bind_text(stmt, 2, name.c_str(), -1, nullptr));
+		checksql(sqlite3_step(stmt));
+		sqlite3_finalize(stmt);
+	}
+	
+	void deck_rename(const std::string &oldname, const std::string &newname)
+	{
+		sqlite3_stmt *stmt;
+		if (db == nullptr) throw std::runtime_error{"Database connection unexpectedly closed"};
+		
+		std::vector<std::pair<std::string, std::string>> columns{{"card", "deck"}, {"deck", "name"}, {"filter", "deck"}, {"character", "deck"}, {"character_category", "deck"}};
+		transac_begin();
+		for (const std::pair<std::string, std::string> &col : columns)
+		{
+			std::string query = "update `" + col.first + "` set `" + col.second + "` = ?2 || substr(`" + col.second + "`, length(?1) + 1) where `" + col.second + "` = ?1 or substr(`" + col.second + "`, 1, length(?1) + 1) = ?1 || '/'";
+			checksql(sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr));
+			checksql(sqlite3_bind_text(stmt, 1, oldname.c_str(), -1, nullptr));
+			checksql(sqlite3_bind_text(stmt, 2, newname.c_str(), -1, nullptr));
 			checksql(sqlite3_step(stmt));
 			sqlite3_finalize(stmt);
 		}
+		transac_end();
+	}
+	
+	void bank_edit(const Deck &deck, const std::string &character, bool active, int step, int count)
+	{
+		sqlite3_stmt *stmt;
+		if (db == nullptr) throw std::runtime_error{"Database connection unexpectedly closed"};
 		
 		int i = 1;
 		if (active)
@@ -392,12 +520,31 @@ namespace backend
 			checksql(sqlite3_bind_int(stmt, i++, count));
 		}
 		else checksql(sqlite3_prepare_v2(db, "update `character` set `active` = '0' where `deck` = ? and `character` = ?", -1, &stmt, nullptr));
-		checksql(sqlite3_bind_text(stmt, i++, deck.canonical().c_str(), -1, nullptr));
+		std::string name{deck.canonical()};
+		checksql(sqlite3_bind_text(stmt, i++, name.c_str(), -1, nullptr));
 		checksql(sqlite3_bind_text(stmt, i++, character.c_str(), -1, nullptr));
 		checksql(sqlite3_step(stmt));
 		sqlite3_finalize(stmt);
 	}
 	
+	void bank_section(const Deck &deck, const std::string &category, bool active, int step)
+	{
+		sqlite3_stmt *stmt;
+		if (db == nullptr) throw std::runtime_error{"Database connection unexpectedly closed"};
+		
+		std::string name{deck.canonical()};
+		if (active)
+		{
+			checksql(sqlite3_prepare_v2(db, "update `character` set `active` = '1', `step` = ?, `count` = 0 where `deck` = ? and `category` = ? and `active` = '0'", -1, &stmt, nullptr));
+			checksql(sqlite3_bind_int(stmt, 1, step));
+		}
+		else checksql(sqlite3_prepare_v2(db, "update `character` set `active` = '0' where `deck` = ?2 and `category` = ?3", -1, &stmt, nullptr));
+		checksql(sqlite3_bind_text(stmt, 2, name.c_str(), -1, nullptr));
+		checksql(sqlite3_bind_text(stmt, 3, category.c_str(), -1, nullptr));
+		checksql(sqlite3_step(stmt));
+		sqlite3_finalize(stmt);
+	}
+	
 	void step(int offset)
 	{
 		sqlite3_stmt *stmt;
@@ -29,23 +29,29 @@ class Deck;
 namespace backend
 {
 	extern sqlite3 *db;
-	static const int db_version = 2;
+	static const int db_version = 3; // 3 added deck epochs and set filters
 	std::time_t midnight();
+	std::string confdir(); // Where the deck database and logs are kept
 	
 	void init(const std::vector<std::string> &args);
 	void db_setup(const std::string &fname);
+	void upgrade(int from); // Bring an older database up to db_version
 	void early_populate();
 	void populate();
 	void commit();
 	void cleanup();
-	void transac_begin();
+	void transac_begin(); // Transactions nest, and only the outermost commits
 	void transac_end();
 	void card_update(const Card &card);
 	void card_edit(const Card &card, const std::string &field);
 	void card_del(const Card &card);
 	void deck_edit(const Deck &deck, std::string oldname = "");
 	void deck_del(const Deck &deck);
-	void bank_edit(const Deck &deck, const std::string &character, bool active, int step, int count, std::string olddeck = "");
+	void deck_filters(const Deck &deck);
+	void deck_epoch(const Deck &deck);
+	void deck_rename(const std::string &oldname, const std::string &newname); // Rename a deck and everything under it
+	void bank_edit(const Deck &deck, const std::string &character, bool active, int step, int count);
+	void bank_section(const Deck &deck, const std::string &category, bool active, int step);
 	void step(int offset);
 }
 
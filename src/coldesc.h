@@ -24,12 +24,13 @@ struct coldesc
 	{
 		type = type_;
 		width = width_;
-		title = util::strto(desc, ":");
-		if (type == Type::CHOICE) while (desc != "") choices.push_back(util::strto(desc, ","));
+		std::string_view rest{desc};
+		title = util::strto(rest, ":");
+		if (type == Type::CHOICE) while (! rest.empty()) choices.emplace_back(util::strto(rest, ","));
 		else if (type == Type::INT)
 		{
-			std::string min_ = util::strto(desc, ",");
-			std::string max_ = util::strto(desc, ",");
+			std::string_view min_ = util::strto(rest, ",");
+			std::string_view max_ = util::strto(rest, ",");
 			if (min_ == "") min = 0;
 			else min = util::s2t<int>(min_);
 			if (max_ == "") max = 1000000000;
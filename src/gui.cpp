@@ -12,18 +12,27 @@
 #include <wx/dataview.h>
 #include <wx/srchctrl.h>
 #include <wx/html/htmlwin.h>
-#include "wx/html/m_templ.h"
+#include <wx/vscroll.h>
+#include <wx/dcbuffer.h>
 #include "Deck.h"
 #include "Set.h"
 #include "Card.h"
 #include "Bank.h"
 #include "coldesc.h"
 #include "backend.h"
+#include "Notify.h"
+#include "Render.h"
+#include "Watchdog.h"
 #include <algorithm>
 #include <exception>
 #include <stdexcept>
 #include <unordered_map>
+#include <unordered_set>
 #include <queue>
+#include <list>
+#include <functional>
+#include <thread>
+#include <atomic>
 
 #define PROGRAM "Tango"
 #define VERSION "0.4"
@@ -67,7 +76,7 @@ std::string wx2utf8(const wxString &str)
  * GUI structure
  ******************************************************************************/
 
-enum { id_menu_about, id_menu_quit, id_menu_refresh, id_notebook, id_decks_tree, id_browse_cards, id_card_add, id_card_del, id_card_find, id_browse_decks, id_deck_add, id_deck_del, id_set_type, id_browse_bank, id_offset_forward, id_offset_back };
+enum { id_menu_about, id_menu_quit, id_menu_refresh, id_notebook, id_decks_tree, id_browse_cards, id_card_add, id_card_del, id_card_find, id_browse_decks, id_deck_add, id_deck_del, id_deck_sets, id_set_type, id_browse_bank, id_offset_forward, id_offset_back, id_forecast_reviews, id_search_results, id_cards_move, id_cards_suspend, id_cards_resume, id_cards_reset, id_cards_interval, id_heartbeat, id_watchdog };
 
 namespace std
 {
@@ -84,46 +93,301 @@ class App: public wxApp
 	MainFrame *frame;
 };
 
+class BankGrid : public wxVScrolledWindow // Draws only the visible rows of a bank's kanji instead of making a button for each
+{
+private:
+	struct Cell
+	{
+		uint32_t c;
+		wxString glyph;
+		bool enabled;
+		int offset;
+		unsigned int practices;
+	};
+	struct Row
+	{
+		int heading; // Section whose name this row shows, or -1 for a row of cells
+		std::size_t first, count; // Cells in this row
+	};
+	static const int cellsize = 46, margin = 4;
+	const Bank *bank_;
+	std::vector<std::string> sections_;
+	std::vector<std::pair<std::size_t, std::size_t>> spans_; // Cells of each section
+	std::vector<Cell> cells_;
+	std::vector<Row> rows_;
+	std::vector<std::size_t> rowof_; // Row holding each cell
+	std::size_t cols_;
+	int hover_;
+	wxFont glyphfont_, smallfont_, headfont_;
+	std::function<void(const std::string &, bool)> toggle_, togglesect_;
+	void load(Cell &cell);
+	void layout();
+	int hit(const wxPoint &pos) const; // Cell under the point, -2 - s for the heading of section s, or -1
+	wxRect cellrect(std::size_t cell) const;
+	virtual wxCoord OnGetRowHeight(size_t row) const override { return cellsize; }
+	void paint(wxPaintEvent &event);
+	void resize(wxSizeEvent &event);
+	void click(wxMouseEvent &event);
+	void motion(wxMouseEvent &event);
+public:
+	BankGrid(wxWindow *parent, std::function<void(const std::string &, bool)> toggle, std::function<void(const std::string &, bool)> togglesect); // Called with a kanji or section name and whether to enable it
+	void bank(const Bank *b); // Show this bank, or nothing if null
+	void reload(); // Reread every cell after the bank's words change
+};
+
+class CardView : public wxWindow // Draws the study card directly, with furigana set over the characters they read, instead of laying out HTML tables
+{
+private:
+	struct Run
+	{
+		wxString base, reading;
+		wxCoord width, basewidth, readwidth;
+	};
+	struct Block
+	{
+		const wxFont *font;
+		wxCoord height, rubyheight; // Of a line of text, and of the furigana above it, which is zero for fields without any
+		std::vector<Run> runs;
+	};
+	typedef std::vector<Block> Layout;
+	static const std::size_t cachesize = 64;
+	static const int margin = 10;
+	wxFont bigfont_, textfont_, boldfont_, rubyfont_;
+	std::list<std::pair<Render::Face, Layout>> layouts_; // Measured faces, oldest first
+	Render::Face face_; // Being shown, or null to show message_ instead
+	const Layout *layout_;
+	wxString message_;
+	const Layout &measure(const Render::Face &face);
+	void paint(wxPaintEvent &event);
+public:
+	CardView(wxWindow *parent);
+	void show(const Render::Face &face);
+	void prepare(const Render::Face &face) { measure(face); } // Measure ahead of time, so showing it is just drawing
+	void message(const std::string &text);
+};
+
+class DeckItem : public wxTreeItemData // The deck or set a tree item stands for
+{
+public:
+	Deck *deck;
+	Set::SetType type;
+	bool set; // One of the deck's sets rather than the deck itself
+	bool filled; // Children are only added when the item is first expanded
+	DeckItem(Deck *d, Set::SetType st, bool s) : wxTreeItemData{}, deck{d}, type{st}, set{s}, filled{false} { }
+	std::string label() const
+	{
+		if (set) return Set::st2str(type) + " (" + util::t2s<int>(deck->set(type).size()) + ")";
+		return deck->name() + " (" + util::t2s<int>(deck->set(Set::SetType::NORMAL).size()) + ")";
+	}
+};
+
+template <typename T> struct Column // A table column compiled into accessors for its cells, so reading a cell doesn't match titles or go through strings
+{
+	coldesc::Type type;
+	std::function<wxVariant(T &)> get;
+	std::function<void(T &, const wxVariant &)> set; // Null if the column can't be edited
+};
+
+wxVariant utf8variant(const std::string &str)
+{
+	return wxVariant{wxString::FromUTF8(str.data(), str.size())};
+}
+
+Column<Card> cardcolumn(const coldesc &col)
+{
+	typedef Column<Card> C;
+	if (col.title == "Deck") return C{col.type, [](Card &card) { return utf8variant(card.deck()->canonical()); }, [](Card &card, const wxVariant &value) { card.edit(Deck::get(wx2utf8(value.GetString())), card.offset(), card.delay(), card.status()); }};
+	if (col.title == "Status") return C{col.type, [](Card &card) { return utf8variant(Card::stat2str(card.status())); }, [](Card &card, const wxVariant &value) { card.edit(*card.deck(), card.offset(), card.delay(), Card::str2stat(wx2utf8(value.GetString()))); }};
+	if (col.title == "Offset") return C{col.type, [](Card &card) { return wxVariant{static_cast<long>(card.offset())}; }, [](Card &card, const wxVariant &value) { card.edit(*card.deck(), value.GetLong(), card.delay(), card.status()); }};
+	if (col.title == "Interval") return C{col.type, [](Card &card) { return wxVariant{static_cast<long>(card.delay())}; }, [](Card &card, const wxVariant &value) { card.edit(*card.deck(), card.offset(), value.GetLong(), card.status()); }};
+	std::unordered_map<std::string, Card::UpdateType> counts{{"Norm", Card::UpdateType::NORM}, {"Incr", Card::UpdateType::INCR}, {"Decr", Card::UpdateType::DECR}, {"Reset", Card::UpdateType::RESET}};
+	if (counts.count(col.title))
+	{
+		Card::UpdateType type = counts.at(col.title);
+		return C{col.type, [type](Card &card) { return wxVariant{static_cast<long>(card.count(type))}; }, nullptr};
+	}
+	if (col.type == coldesc::Type::FIELD)
+	{
+		std::size_t id = Card::fieldid(col.title);
+		std::string name = col.title;
+		return C{col.type, [id](Card &card) { return id < card.slots().size() && card.slots()[id] ? utf8variant(*card.slots()[id]) : wxVariant{"NULL"}; }, [name](Card &card, const wxVariant &value) { card.field(name, wx2utf8(value.GetString())); }};
+	}
+	return C{col.type, [](Card &card) { return wxVariant{"NULL"}; }, nullptr};
+}
+
+Column<Deck> deckcolumn(const coldesc &col)
+{
+	typedef Column<Deck> C;
+	if (col.title == "Name") return C{col.type, [](Deck &deck) { return utf8variant(deck.canonical()); }, [](Deck &deck, const wxVariant &value)
+	{
+		if (! deck.edit(wx2utf8(value.GetString()), deck.explic())) throw std::runtime_error{"Deck editing failed"}; // TODO This should not be a fatal error; just pop something up
+	}};
+	if (col.title == "Cards") return C{col.type, [](Deck &deck) { return wxVariant{static_cast<long>(deck.size())}; }, nullptr};
+	if (col.title == "Due") return C{col.type, [](Deck &deck) { return wxVariant{static_cast<long>(deck.set(Set::SetType::NORMAL).size())}; }, nullptr};
+	if (col.title == "Explicit") return C{col.type, [](Deck &deck) { return wxVariant{deck.explic()}; }, [](Deck &deck, const wxVariant &value)
+	{
+		if (! deck.edit(deck.canonical(), value.GetBool())) throw std::runtime_error{"Deck editing failed"};
+	}};
+	return C{col.type, [](Deck &deck) { return wxVariant{"NULL"}; }, nullptr};
+}
+
+template <typename T> class TableModel : public wxDataViewVirtualListModel // Rows of the card or deck table, whose cells are read from the objects only when drawn
+{
+private:
+	std::vector<Column<T>> columns_;
+	std::vector<T *> rows_;
+	std::unordered_map<const T *, int> rowof_; // Inverse of rows_
+	std::function<void(T &, const Column<T> &, const wxVariant &)> edit_;
+	std::function<void(const std::exception &)> error_;
+	void reindex(std::size_t from = 0) { for (std::size_t i = from; i < rows_.size(); i++) rowof_[rows_[i]] = i; }
+public:
+	TableModel(const std::vector<coldesc> &columns, std::function<Column<T>(const coldesc &)> compile, std::function<void(T &, const Column<T> &, const wxVariant &)> edit, std::function<void(const std::exception &)> error) : wxDataViewVirtualListModel{0}, columns_{}, rows_{}, rowof_{}, edit_{edit}, error_{error}
+	{
+		for (const coldesc &col : columns) columns_.push_back(compile(col));
+	}
+	virtual unsigned int GetColumnCount() const override { return columns_.size(); }
+	virtual wxString GetColumnType(unsigned int col) const override
+	{
+		if (columns_[col].type == coldesc::Type::INT) return "long";
+		if (columns_[col].type == coldesc::Type::BOOL) return "bool";
+		return "string";
+	}
+	virtual void GetValueByRow(wxVariant &variant, unsigned int row, unsigned int col) const override
+	{
+		if (row < rows_.size()) variant = columns_[col].get(*rows_[row]);
+	}
+	virtual bool SetValueByRow(const wxVariant &variant, unsigned int row, unsigned int col) override
+	{
+		if (row >= rows_.size() || ! columns_[col].set) return false;
+		try { edit_(*rows_[row], columns_[col], variant); }
+		catch (std::exception &e)
+		{
+			error_(e);
+			return false;
+		}
+		return true;
+	}
+	
+	T *at(int row) const { return (row >= 0 && row < static_cast<int>(rows_.size())) ? rows_[row] : nullptr; }
+	int row(const T *t) const // -1 if the object is not in the table
+	{
+		typename std::unordered_map<const T *, int>::const_iterator iter = rowof_.find(t);
+		return iter == rowof_.end() ? -1 : iter->second;
+	}
+	int row(const wxDataViewItem &item) const { return item.IsOk() ? static_cast<int>(GetRow(item)) : -1; }
+	void reset(std::vector<T *> &&rows)
+	{
+		rows_ = std::move(rows);
+		rowof_.clear();
+		reindex();
+		Reset(rows_.size());
+	}
+	int append(T &t)
+	{
+		rowof_[&t] = rows_.size();
+		rows_.push_back(&t);
+		RowAppended();
+		return rows_.size() - 1;
+	}
+	void erase(int row)
+	{
+		rowof_.erase(rows_[row]);
+		rows_.erase(rows_.begin() + row);
+		reindex(row);
+		RowDeleted(row);
+	}
+	void erase(const std::unordered_set<const T *> &objs) // Remove all of their rows in one pass
+	{
+		wxArrayInt gone{};
+		std::size_t out = 0;
+		for (std::size_t i = 0; i < rows_.size(); i++)
+		{
+			if (objs.count(rows_[i]))
+			{
+				rowof_.erase(rows_[i]);
+				gone.Add(i);
+			}
+			else rows_[out++] = rows_[i];
+		}
+		if (gone.empty()) return;
+		rows_.resize(out);
+		reindex(gone[0]);
+		RowsDeleted(gone);
+	}
+	void sort(unsigned int col, bool ascending) // Reorder the rows by a column's values, as when its header is clicked
+	{
+		std::vector<std::pair<wxVariant, T *>> keys{};
+		keys.reserve(rows_.size());
+		for (T *t : rows_) keys.push_back(std::make_pair(columns_[col].get(*t), t));
+		coldesc::Type type = columns_[col].type;
+		auto less = [type](const wxVariant &a, const wxVariant &b)
+		{
+			if (type == coldesc::Type::INT || type == coldesc::Type::STATIC_INT) return a.GetLong() < b.GetLong();
+			if (type == coldesc::Type::BOOL) return a.GetBool() < b.GetBool();
+			return a.GetString() < b.GetString();
+		};
+		std::stable_sort(keys.begin(), keys.end(), [less, ascending](const std::pair<wxVariant, T *> &a, const std::pair<wxVariant, T *> &b) { return ascending ? less(a.first, b.first) : less(b.first, a.first); });
+		for (std::size_t i = 0; i < keys.size(); i++) rows_[i] = keys[i].second;
+		reindex();
+		Reset(rows_.size());
+	}
+	void changed(const T *t)
+	{
+		int r = row(t);
+		if (r >= 0) RowChanged(r);
+	}
+};
+
 class MainFrame : public wxFrame
 {
 public:
 	MainFrame(const wxString& title, const wxPoint& pos, const wxSize& size);
-	void populate_decktree(Deck *d = &Deck::root);
-	void populate_table_cols(wxDataViewListCtrl *table, const std::vector<coldesc> &columns);
-	wxVector<wxVariant> cols2wxvec(std::vector<coldesc> colspec, std::vector<std::string> cols);
-	void table_updaterow(wxDataViewListCtrl *table, int row, const wxVector<wxVariant> &data);
+	void populate_decktree();
+	void populate_table_cols(wxDataViewCtrl *table, const std::vector<coldesc> &columns);
 	void pagechange();
 	void showcard();
+	void prefetch();
 	void addcard();
-	void delcard(int row);
+	void delcards(const std::vector<Card *> &cards);
+	void editcards(const std::vector<Card *> &cards, const std::function<void(Card &)> &change);
 	void stattext(const std::string &text = "");
 	void setbankitem(const std::string word, bool enabled);
 	void populate_cardtable(std::string filter = "");
 	void populate_decktable();
 	void populate_bankview();
+	void populate_forecast();
 	void refresh_views(int mode = 0xff);
-	void debug_tablecheck();
+	void modelchanged(const Notify::Changes &changes);
 	void about(wxCommandEvent &event);
 	void quit(wxCommandEvent &event);
 	void refresh(wxCommandEvent &event);
 	void switch_deck(wxTreeEvent &event);
+	void expand_deck(wxTreeEvent &event);
 	void activate_deck(wxTreeEvent &event);
 	void page_changed(wxNotebookEvent &event);
 	void ensure_exists(const std::string &deck);
 	void offset_advanced(wxCommandEvent &event);
 	void offset_reversed(wxCommandEvent &event);
+	void forecast_toggled(wxCommandEvent &event);
 	void card_added(wxCommandEvent &event);
 	void card_deleted(wxCommandEvent &event);
 	void card_searched(wxCommandEvent &event);
+	void card_found(wxThreadEvent &event);
 	void card_edited(wxDataViewEvent &event);
+	void card_menu(wxDataViewEvent &event);
+	void cards_edited(wxCommandEvent &event);
+	void table_sorted(wxDataViewEvent &event);
 	void deck_added(wxCommandEvent &event);
 	void deck_deleted(wxCommandEvent &event);
+	void deck_setsedit(wxCommandEvent &event);
 	void deck_edited(wxDataViewEvent &event);
-	void bankitem_set(wxHtmlLinkEvent &event);
 	//void change_settype(wxCommandEvent &event);
 	void keydown(wxKeyEvent &event);
+	void idle(wxIdleEvent &event);
 	void key_view(wxKeyEvent &event);
 	void close(wxCloseEvent &event);
+	void heartbeat_ticked(wxTimerEvent &event);
+	void watchdog_logged(wxThreadEvent &event);
 	void err(const std::string msg);
 	void except(const std::exception &e);
 	
@@ -131,7 +395,6 @@ public:
 	//Set::SetType settype;
 	Set::DispType disp;
 	wxFont font_header;
-	std::string html_pref, html_suff;
 private:
 	wxNotebook *notebook;
 	wxPanel *panel_tree;
@@ -140,73 +403,322 @@ private:
 	wxPanel *panel_cards;
 	wxPanel *panel_decks;
 	wxPanel *panel_bank;
+	wxPanel *panel_watch;
 	
 	wxTreeCtrl *tree_decks;
 	wxButton *offset_forward;
 	wxButton *offset_back;
 	
 	wxStaticText *deck_name;
+	wxCheckBox *forecast_reviews;
+	wxHtmlWindow *deck_forecast;
+	bool forecast_stale; // The model changed since the forecast was drawn
 	
-	wxHtmlWindow *study_view;
+	CardView *study_view;
+	Render render;
 
-	wxDataViewListCtrl *browse_cards;
+	wxDataViewCtrl *browse_cards;
+	TableModel<Card> *card_model;
 	std::vector<coldesc> card_columns;
 	wxDataViewSpinRenderer *dropdownRenderer;
 	wxButton *card_add;
 	wxButton *card_del;
 	wxSearchCtrl *card_find;
+	std::thread searcher;
+	std::atomic<int> searchgen; // Bumped whenever the card table is repopulated, so older searches stop and their results are dropped
 	
-	wxDataViewListCtrl *browse_decks;
+	wxDataViewCtrl *browse_decks;
+	TableModel<Deck> *deck_model;
 	std::vector<coldesc> deck_columns;
 	wxButton *deck_add;
 	wxButton *deck_del;
+	wxButton *deck_sets;
 	
-	std::unordered_map<std::string, wxTreeItemId> deckids;
-	std::unordered_map<wxDataViewItem, Card *> card_rows;
-	std::unordered_map<wxDataViewItem, Deck *> deck_rows;
+	std::unordered_map<const Deck *, wxTreeItemId> deckitems; // Decks whose parents' children have been added to the tree
 	std::unordered_map<wxDataViewItem, std::string> bank_rows;
 	
-	wxHtmlWindow *bank_view;
+	BankGrid *bank_grid;
+	
+	wxTextCtrl *watch_log;
+	wxTimer heartbeat; // Lets the watchdog see that the event loop is running
 	
 	std::pair<Deck *, Set::SetType> tree2deck(wxTreeItemId id);
+	DeckItem *itemdata(const wxTreeItemId &id) const;
+	wxTreeItemId deckitem(Deck *d);
+	wxTreeItemId insert_deckitem(const wxTreeItemId &parent, std::size_t pos, Deck *d);
+	wxTreeItemId add_deckitem(Deck *d);
+	void del_deckitem(const wxTreeItemId &item);
+	void fill_deckitem(const wxTreeItemId &item);
 	Card *row2card(int row);
 	int card2row(Card *card);
+	std::vector<Card *> selcards(); // In table order
 	int table_addcard(Card &card);
-	void table_delcard(int row);
+	void editcard(Card &card, const Column<Card> &col, const wxVariant &value);
 	Deck *row2deck(int row);
 	int deck2row(Deck *deck);
 	int table_adddeck(Deck &deck);
-	void table_deldeck(int row);
+	void relabel(Deck *d);
+	void editdeck(Deck &deck, const Column<Deck> &col, const wxVariant &value);
 	
 	DECLARE_EVENT_TABLE()
 };
 
-TAG_HANDLER_BEGIN(BANKBTN, "BANKBTN")
-TAG_HANDLER_PROC(tag)
-{
-	MainFrame *frame = (MainFrame *) m_WParser->GetWindowInterface()->GetHTMLWindow()->GetParent()->GetParent()->GetParent(); // Is there seriously no easier way to get the frame in this context?	
-	wxString word = tag.GetParam(_("name"));
-	std::string wordstr = wx2utf8(word);
-	bool enabled = frame->curset->deck().bank().enabled(wordstr);
-	wxButton *button = new wxButton{m_WParser->GetWindowInterface()->GetHTMLWindow(), wxID_ANY, word, wxDefaultPosition, wxSize{46, 46}, wxBORDER_NONE};
-	button->SetFont(wxFont{24, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_NORMAL});
-	button->SetForegroundColour(enabled ? wxColour{_("black")} : wxColour{_("gray")});
-	button->Bind(wxEVT_BUTTON, [=](wxCommandEvent &event)
-	{
-		bool en = ! frame->curset->deck().bank().enabled(wordstr);
-		button->SetForegroundColour(en ? wxColour{"black"} : wxColour{"gray"});
-		frame->setbankitem(wordstr, en);
-	});
-	button->Show(true);
-	m_WParser->GetContainer()->InsertCell(new wxHtmlWidgetCell(button, 0));
-	
-	return false;
+BankGrid::BankGrid(wxWindow *parent, std::function<void(const std::string &, bool)> toggle, std::function<void(const std::string &, bool)> togglesect) : wxVScrolledWindow{parent, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxVSCROLL | wxFULL_REPAINT_ON_RESIZE}, bank_{nullptr}, sections_{}, spans_{}, cells_{}, rows_{}, rowof_{}, cols_{1}, hover_{-1}, glyphfont_{24, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_NORMAL}, smallfont_{7, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_NORMAL}, headfont_{12, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_BOLD}, toggle_{toggle}, togglesect_{togglesect}
+{
+	SetBackgroundStyle(wxBG_STYLE_PAINT);
+	Bind(wxEVT_PAINT, &BankGrid::paint, this);
+	Bind(wxEVT_SIZE, &BankGrid::resize, this);
+	Bind(wxEVT_LEFT_DOWN, &BankGrid::click, this);
+	Bind(wxEVT_MOTION, &BankGrid::motion, this);
+	Bind(wxEVT_LEAVE_WINDOW, [this](wxMouseEvent &event) { hover_ = -1; UnsetToolTip(); event.Skip(); });
+}
+
+void BankGrid::bank(const Bank *b)
+{
+	bank_ = b;
+	sections_.clear();
+	spans_.clear();
+	cells_.clear();
+	hover_ = -1;
+	if (bank_) for (std::pair<std::string, std::vector<uint32_t>> &section : bank_->sections())
+	{
+		sections_.push_back(section.first);
+		spans_.push_back(std::make_pair(cells_.size(), cells_.size() + section.second.size()));
+		for (uint32_t c : section.second)
+		{
+			std::string utf8 = util::utf8_encode(c);
+			cells_.push_back(Cell{c, wxString::FromUTF8(utf8.c_str(), utf8.size()), false, 0, 0});
+			load(cells_.back());
+		}
+	}
+	layout();
+}
+
+void BankGrid::reload()
+{
+	if (! bank_) return;
+	for (Cell &cell : cells_) load(cell);
+	Refresh();
+}
+
+void BankGrid::load(Cell &cell)
+{
+	const Bank::BankItem *bi = bank_->item(cell.c);
+	cell.enabled = bi != nullptr;
+	cell.offset = bi ? bi->offset(bank_->epoch()) : 0;
+	cell.practices = bi ? bi->practices : 0;
+}
+
+void BankGrid::layout() // Flow each section's cells into rows as wide as the window
+{
+	cols_ = std::max(1, (GetClientSize().GetWidth() - 2 * margin) / cellsize);
+	rows_.clear();
+	rowof_.assign(cells_.size(), 0);
+	for (std::size_t s = 0; s < sections_.size(); s++)
+	{
+		rows_.push_back(Row{static_cast<int>(s), 0, 0});
+		for (std::size_t first = spans_[s].first; first < spans_[s].second; first += cols_)
+		{
+			std::size_t count = std::min(cols_, spans_[s].second - first);
+			for (std::size_t i = first; i < first + count; i++) rowof_[i] = rows_.size();
+			rows_.push_back(Row{-1, first, count});
+		}
+	}
+	SetRowCount(rows_.size());
+	Refresh();
+}
+
+wxRect BankGrid::cellrect(std::size_t cell) const
+{
+	const Row &row = rows_[rowof_[cell]];
+	return wxRect{margin + static_cast<int>(cell - row.first) * cellsize, (static_cast<int>(rowof_[cell]) - static_cast<int>(GetVisibleRowsBegin())) * cellsize, cellsize, cellsize};
+}
+
+int BankGrid::hit(const wxPoint &pos) const
+{
+	int r = VirtualHitTest(pos.y);
+	if (r != wxNOT_FOUND && static_cast<std::size_t>(r) < rows_.size() && rows_[r].heading >= 0) return -2 - rows_[r].heading;
+	if (r == wxNOT_FOUND || static_cast<std::size_t>(r) >= rows_.size() || rows_[r].heading >= 0 || pos.x < margin) return -1;
+	std::size_t col = (pos.x - margin) / cellsize;
+	if (col >= rows_[r].count) return -1;
+	return rows_[r].first + col;
+}
+
+void BankGrid::paint(wxPaintEvent &event)
+{
+	wxAutoBufferedPaintDC dc{this};
+	dc.SetBackground(*wxWHITE_BRUSH);
+	dc.Clear();
+	if (! bank_)
+	{
+		dc.DrawLabel(_("(No deck selected)"), wxRect{0, 0, GetClientSize().GetWidth(), cellsize}, wxALIGN_CENTER);
+		return;
+	}
+	for (std::size_t r = GetVisibleRowsBegin(); r < GetVisibleRowsEnd() && r < rows_.size(); r++)
+	{
+		int y = (r - GetVisibleRowsBegin()) * cellsize;
+		if (rows_[r].heading >= 0)
+		{
+			dc.SetFont(headfont_);
+			dc.SetTextForeground(wxColour{"black"});
+			dc.DrawLabel(wxString::FromUTF8(sections_[rows_[r].heading].c_str()), wxRect{margin, y, GetClientSize().GetWidth() - 2 * margin, cellsize - margin}, wxALIGN_LEFT | wxALIGN_BOTTOM);
+			continue;
+		}
+		for (std::size_t i = rows_[r].first; i < rows_[r].first + rows_[r].count; i++)
+		{
+			const Cell &cell = cells_[i];
+			wxRect rect = cellrect(i);
+			dc.SetFont(glyphfont_);
+			dc.SetTextForeground(cell.enabled ? wxColour{"black"} : wxColour{"gray"});
+			dc.DrawLabel(cell.glyph, rect, wxALIGN_CENTER);
+			if (cell.enabled && cell.practices)
+			{
+				dc.SetFont(smallfont_);
+				dc.DrawLabel(wxString::FromUTF8(util::t2s(cell.practices).c_str()), wxRect{rect.x, rect.y, rect.width - 2, rect.height - 1}, wxALIGN_RIGHT | wxALIGN_BOTTOM);
+			}
+		}
+	}
+}
+
+CardView::CardView(wxWindow *parent) : wxWindow{parent, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxWANTS_CHARS | wxFULL_REPAINT_ON_RESIZE}, bigfont_{32, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_NORMAL}, textfont_{16, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_NORMAL}, boldfont_{16, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_BOLD}, rubyfont_{12, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_NORMAL}, layouts_{}, face_{}, layout_{nullptr}, message_{}
+{
+	SetBackgroundStyle(wxBG_STYLE_PAINT);
+	Bind(wxEVT_PAINT, &CardView::paint, this);
+	Bind(wxEVT_LEFT_DOWN, [this](wxMouseEvent &event) { SetFocus(); event.Skip(); });
+}
+
+const CardView::Layout &CardView::measure(const Render::Face &face) // Text extents are the slow part of drawing, so they're kept for each face
+{
+	for (const std::pair<Render::Face, Layout> &cached : layouts_) if (cached.first == face) return cached.second;
+	wxClientDC dc{this};
+	dc.SetFont(rubyfont_);
+	wxCoord rubyheight = dc.GetTextExtent(_("あ")).GetHeight();
+	Layout layout{};
+	for (const Card::Block &field : *face)
+	{
+		Block block{&textfont_, 0, 0, {}};
+		if (field.field == Card::Field::KANJI || field.field == Card::Field::FURIGANA || (field.field == Card::Field::HIRAGANA && face->size() == 1)) block.font = &bigfont_;
+		else if (field.field == Card::Field::MEANING) block.font = &boldfont_;
+		if (field.field == Card::Field::KANJI || field.field == Card::Field::FURIGANA) block.rubyheight = rubyheight;
+		dc.SetFont(*block.font);
+		block.height = dc.GetTextExtent(_("あ")).GetHeight();
+		for (const Card::Ruby &ruby : field.runs)
+		{
+			Run run{wxString::FromUTF8(ruby.base.c_str(), ruby.base.size()), wxString::FromUTF8(ruby.reading.c_str(), ruby.reading.size()), 0, 0, 0};
+			dc.SetFont(*block.font);
+			run.basewidth = dc.GetTextExtent(run.base).GetWidth();
+			dc.SetFont(rubyfont_);
+			run.readwidth = run.reading.IsEmpty() ? 0 : dc.GetTextExtent(run.reading).GetWidth();
+			run.width = std::max(run.basewidth, run.readwidth);
+			block.runs.push_back(run);
+		}
+		layout.push_back(std::move(block));
+	}
+	if (layouts_.size() >= cachesize) layouts_.erase(layouts_.front().first == face_ ? std::next(layouts_.begin()) : layouts_.begin()); // Never the one on screen, which layout_ points into
+	layouts_.push_back(std::make_pair(face, std::move(layout)));
+	return layouts_.back().second;
+}
+
+void CardView::show(const Render::Face &face)
+{
+	if (face == face_) return; // Nothing to repaint
+	face_ = face;
+	layout_ = &measure(face);
+	Refresh();
+}
+
+void CardView::message(const std::string &text)
+{
+	wxString msg = wxString::FromUTF8(text.c_str());
+	if (! face_ && msg == message_) return;
+	face_ = nullptr;
+	layout_ = nullptr;
+	message_ = msg;
+	Refresh();
+}
+
+void CardView::paint(wxPaintEvent &event)
+{
+	wxAutoBufferedPaintDC dc{this};
+	dc.SetBackground(*wxWHITE_BRUSH);
+	dc.Clear();
+	dc.SetTextForeground(wxColour{"black"});
+	int width = GetClientSize().GetWidth() - 2 * margin;
+	if (! layout_)
+	{
+		dc.SetFont(textfont_);
+		dc.DrawLabel(message_, wxRect{margin, margin, width, GetClientSize().GetHeight() - 2 * margin}, wxALIGN_CENTRE_HORIZONTAL | wxALIGN_TOP);
+		return;
+	}
+	int y = margin;
+	for (const Block &block : *layout_)
+	{
+		for (std::size_t first = 0; first < block.runs.size(); ) // Fill each line with as many runs as fit, centered
+		{
+			std::size_t last = first;
+			wxCoord linewidth = 0;
+			while (last < block.runs.size() && (last == first || linewidth + block.runs[last].width <= width)) linewidth += block.runs[last++].width;
+			int x = margin + (width - linewidth) / 2;
+			for (std::size_t i = first; i < last; i++)
+			{
+				const Run &run = block.runs[i];
+				if (! run.reading.IsEmpty())
+				{
+					dc.SetFont(rubyfont_);
+					dc.DrawText(run.reading, x + (run.width - run.readwidth) / 2, y);
+				}
+				dc.SetFont(*block.font);
+				dc.DrawText(run.base, x + (run.width - run.basewidth) / 2, y + block.rubyheight);
+				x += run.width;
+			}
+			y += block.rubyheight + block.height;
+			first = last;
+		}
+		y += block.height; // Blank line between fields
+	}
+}
+
+void BankGrid::resize(wxSizeEvent &event)
+{
+	if (std::max(1, (GetClientSize().GetWidth() - 2 * margin) / cellsize) != static_cast<int>(cols_)) layout();
+	event.Skip();
+}
+
+void BankGrid::click(wxMouseEvent &event)
+{
+	int i = hit(event.GetPosition());
+	if (! bank_ || i == -1) return;
+	if (i < -1) // Clicking a heading enables the whole section, or disables it if it is all enabled already
+	{
+		std::size_t s = -2 - i;
+		bool all = std::all_of(cells_.begin() + spans_[s].first, cells_.begin() + spans_[s].second, [](const Cell &cell) { return cell.enabled; });
+		togglesect_(sections_[s], ! all);
+		for (std::size_t c = spans_[s].first; c < spans_[s].second; c++) load(cells_[c]);
+		Refresh();
+		return;
+	}
+	Cell &cell = cells_[i];
+	std::string word = util::utf8_encode(cell.c);
+	toggle_(word, ! cell.enabled);
+	load(cell);
+	RefreshRect(cellrect(i));
+	hover_ = -1; // Reload the tooltip
+}
+
+void BankGrid::motion(wxMouseEvent &event)
+{
+	int i = hit(event.GetPosition());
+	if (i != hover_)
+	{
+		hover_ = i;
+		if (i == -1) UnsetToolTip();
+		else if (i < -1) SetToolTip(_("Click to enable or disable the whole section"));
+		else if (! cells_[i].enabled) SetToolTip(_("Not in bank"));
+		else SetToolTip(wxString::FromUTF8(("Offset " + util::t2s(cells_[i].offset) + ", practiced " + util::t2s(cells_[i].practices) + " times").c_str()));
+	}
+	event.Skip();
 }
-TAG_HANDLER_END(BANKBTN)
 
-TAGS_MODULE_BEGIN(bankbtn)
-TAGS_MODULE_ADD(BANKBTN)
-TAGS_MODULE_END(bankbtn)
 
 BEGIN_EVENT_TABLE(MainFrame, wxFrame)
 	EVT_MENU(id_menu_about, MainFrame::about)
@@ -214,18 +726,34 @@ BEGIN_EVENT_TABLE(MainFrame, wxFrame)
 	EVT_MENU(id_menu_refresh, MainFrame::refresh)
 	EVT_BUTTON(id_offset_forward, MainFrame::offset_advanced)
 	EVT_BUTTON(id_offset_back, MainFrame::offset_reversed)
+	EVT_CHECKBOX(id_forecast_reviews, MainFrame::forecast_toggled)
 	EVT_BUTTON(id_card_add, MainFrame::card_added)
 	EVT_BUTTON(id_card_del, MainFrame::card_deleted)
 	EVT_BUTTON(id_card_find, MainFrame::card_searched)
 	EVT_BUTTON(id_deck_add, MainFrame::deck_added)
 	EVT_BUTTON(id_deck_del, MainFrame::deck_deleted)
+	EVT_BUTTON(id_deck_sets, MainFrame::deck_setsedit)
 	//EVT_CHOICE(id_set_type, MainFrame::change_settype)
 	EVT_TREE_ITEM_ACTIVATED(id_decks_tree, MainFrame::activate_deck)
 	EVT_TREE_SEL_CHANGED(id_decks_tree, MainFrame::switch_deck)
+	EVT_TREE_ITEM_EXPANDING(id_decks_tree, MainFrame::expand_deck)
 	EVT_NOTEBOOK_PAGE_CHANGED(id_notebook, MainFrame::page_changed)
 	EVT_DATAVIEW_ITEM_VALUE_CHANGED(id_browse_cards, MainFrame::card_edited)
+	EVT_DATAVIEW_ITEM_CONTEXT_MENU(id_browse_cards, MainFrame::card_menu)
+	EVT_MENU(id_cards_move, MainFrame::cards_edited)
+	EVT_MENU(id_cards_suspend, MainFrame::cards_edited)
+	EVT_MENU(id_cards_resume, MainFrame::cards_edited)
+	EVT_MENU(id_cards_reset, MainFrame::cards_edited)
+	EVT_MENU(id_cards_interval, MainFrame::cards_edited)
+	EVT_MENU(id_card_del, MainFrame::card_deleted)
 	EVT_DATAVIEW_ITEM_VALUE_CHANGED(id_browse_decks, MainFrame::deck_edited)
+	EVT_DATAVIEW_COLUMN_SORTED(id_browse_cards, MainFrame::table_sorted)
+	EVT_DATAVIEW_COLUMN_SORTED(id_browse_decks, MainFrame::table_sorted)
 	EVT_TEXT(id_card_find, MainFrame::card_searched)
+	EVT_THREAD(id_search_results, MainFrame::card_found)
+	EVT_TIMER(id_heartbeat, MainFrame::heartbeat_ticked)
+	EVT_THREAD(id_watchdog, MainFrame::watchdog_logged)
+	EVT_IDLE(MainFrame::idle)
 	EVT_CLOSE(MainFrame::close)
 END_EVENT_TABLE()
 
@@ -244,7 +772,15 @@ bool App::OnInit() try
 	frame->stattext("Loading decks...");
 	backend::populate();
 	frame->refresh_views();
+	Notify::subscribe([this](const Notify::Changes &changes) { frame->modelchanged(changes); }); // Loaded from scratch, so follow changes from here
 	frame->stattext("No deck selected");
+	int budget = 100; // Milliseconds a handler may take before it is logged
+	if (const char *env = getenv("TANGO_BUDGET"))
+	{
+		try { budget = util::s2t<int>(env); }
+		catch (util::conversion_error &e) { std::cerr << "Warning: ignoring TANGO_BUDGET: " << e.what() << "\n"; }
+	}
+	Watchdog::start(backend::confdir() + "/stall.log", budget);
 	return true;
 }
 catch (std::exception &e)
@@ -256,6 +792,8 @@ catch (std::exception &e)
 
 int App::OnExit()
 {
+	Watchdog::stop();
+	Notify::close();
 	return 0;
 }
 
@@ -280,11 +818,11 @@ void MainFrame::err(const std::string msg)
 MainFrame::MainFrame(const wxString& title, const wxPoint& pos, const wxSize& size) try : wxFrame{NULL, -1, title, pos, size}
 {
 	curset = nullptr;
+	searchgen = 0;
+	forecast_stale = true;
 	//settype = Set::SetType::NORMAL; // TODO User-set
 	disp = Set::DispType::FRONT;
 	font_header = wxFont{-1, wxFONTFAMILY_DEFAULT, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_BOLD};
-	html_pref = "<html><body><center>";
-	html_suff = "</center></body></html>";
 	
 	wxMenu *menu_file = new wxMenu{};
 	menu_file->Append(id_menu_about, _("&About..."));
@@ -320,13 +858,17 @@ MainFrame::MainFrame(const wxString& title, const wxPoint& pos, const wxSize& si
 	deck_name = new wxStaticText{panel_deck, -1, _(""), wxDefaultPosition, wxDefaultSize, wxALIGN_CENTER | wxST_NO_AUTORESIZE};
 	deck_name->SetFont(font_header);
 	sizer_deck->Add(deck_name, 0, wxALIGN_CENTER | wxEXPAND | wxALL, 10);
+	deck_forecast = new wxHtmlWindow{panel_deck};
+	sizer_deck->Add(deck_forecast, 1, wxEXPAND | wxLEFT | wxRIGHT, 10);
+	forecast_reviews = new wxCheckBox{panel_deck, id_forecast_reviews, _("Include reviews")};
+	sizer_deck->Add(forecast_reviews, 0, wxALL, 10);
 	panel_deck->SetSizerAndFit(sizer_deck);
 	notebook->AddPage(panel_deck, _("Overview"));
 	
 	// Study panel
 	panel_study = new wxPanel{notebook, -1, wxPoint(-1, -1), wxSize(-1, -1)};
 	wxSizer *sizer_study = new wxBoxSizer{wxVERTICAL};
-	study_view = new wxHtmlWindow{panel_study};
+	study_view = new CardView{panel_study};
 	study_view->Bind(wxEVT_KEY_UP, &MainFrame::keydown, this);
 	sizer_study->Add(study_view, 1, wxALIGN_CENTER | wxEXPAND | wxALL, 10);
 	panel_study->SetSizerAndFit(sizer_study);
@@ -335,7 +877,7 @@ MainFrame::MainFrame(const wxString& title, const wxPoint& pos, const wxSize& si
 	// Cards panel
 	panel_cards = new wxPanel{notebook, -1, wxPoint(-1, -1), wxSize(-1, -1)};
 	wxSizer *sizer_cards = new wxBoxSizer{wxVERTICAL};
-	browse_cards = new wxDataViewListCtrl{panel_cards, id_browse_cards};
+	browse_cards = new wxDataViewCtrl{panel_cards, id_browse_cards, wxDefaultPosition, wxDefaultSize, wxDV_MULTIPLE};
 	card_columns.push_back(coldesc{coldesc::Type::STRING, "Deck", 160});
 	for (std::string s : Card::fieldnames()) card_columns.push_back(coldesc{coldesc::Type::FIELD, s, 160});
 	card_columns.push_back(coldesc{coldesc::Type::CHOICE, "Status:Active,Suspended,Done,Leech", 80});
@@ -345,6 +887,9 @@ MainFrame::MainFrame(const wxString& title, const wxPoint& pos, const wxSize& si
 	card_columns.push_back(coldesc{coldesc::Type::STATIC_INT, "Incr", 80});
 	card_columns.push_back(coldesc{coldesc::Type::STATIC_INT, "Decr", 80});
 	card_columns.push_back(coldesc{coldesc::Type::STATIC_INT, "Reset", 80});
+	card_model = new TableModel<Card>{card_columns, cardcolumn, [this](Card &card, const Column<Card> &col, const wxVariant &value) { editcard(card, col, value); }, [this](const std::exception &e) { err(e.what()); }};
+	browse_cards->AssociateModel(card_model);
+	card_model->DecRef(); // The control owns it now
 	populate_table_cols(browse_cards, card_columns);
 	sizer_cards->Add(browse_cards, 1, wxALIGN_CENTER | wxEXPAND | wxALL, 10);
 	wxSizer *sizer_card_buttons = new wxBoxSizer{wxHORIZONTAL};
@@ -362,19 +907,24 @@ MainFrame::MainFrame(const wxString& title, const wxPoint& pos, const wxSize& si
 	// Decks panel
 	panel_decks = new wxPanel{notebook, -1, wxPoint(-1, -1), wxSize(-1, -1)};
 	wxSizer *sizer_decks = new wxBoxSizer{wxVERTICAL};
-	browse_decks = new wxDataViewListCtrl{panel_decks, id_browse_decks};
+	browse_decks = new wxDataViewCtrl{panel_decks, id_browse_decks};
 	deck_columns.push_back(coldesc{coldesc::Type::STRING, "Name", 160});
 	deck_columns.push_back(coldesc{coldesc::Type::STATIC_INT, "Cards", 60});
 	deck_columns.push_back(coldesc{coldesc::Type::STATIC_INT, "Due", 60});
 	deck_columns.push_back(coldesc{coldesc::Type::BOOL, "Explicit", 40});
 	//deck_columns.push_back(coldesc{coldesc::Type::CHOICE, "Front:Kanji,Hiragana,Furigana,Meaning,All"});
 	//deck_columns.push_back(coldesc{coldesc::Type::CHOICE, "Back:Kanji,Hiragana,Furigana,Meaning,All"});
+	deck_model = new TableModel<Deck>{deck_columns, deckcolumn, [this](Deck &deck, const Column<Deck> &col, const wxVariant &value) { editdeck(deck, col, value); }, [this](const std::exception &e) { err(e.what()); }};
+	browse_decks->AssociateModel(deck_model);
+	deck_model->DecRef();
 	populate_table_cols(browse_decks, deck_columns);
 	browse_decks->Bind(wxEVT_KEY_DOWN, &MainFrame::key_view, this);
 	sizer_decks->Add(browse_decks, 1, wxALIGN_CENTER | wxEXPAND | wxALL, 10);
 	wxSizer *sizer_deck_buttons = new wxBoxSizer{wxHORIZONTAL};
 	deck_add = new wxButton{panel_decks, id_deck_add, "Add"};
 	deck_del = new wxButton{panel_decks, id_deck_del, "Delete"};
+	deck_sets = new wxButton{panel_decks, id_deck_sets, "Sets"};
+	sizer_deck_buttons->Add(deck_sets, 0, wxALIGN_RIGHT | wxLEFT, 10);
 	sizer_deck_buttons->Add(deck_del, 0, wxALIGN_RIGHT | wxLEFT, 10);
 	sizer_deck_buttons->Add(deck_add, 0, wxALIGN_RIGHT | wxLEFT, 10);
 	sizer_decks->Add(sizer_deck_buttons, 0, wxALIGN_RIGHT | wxLEFT | wxBOTTOM | wxRIGHT, 10);
@@ -384,23 +934,50 @@ MainFrame::MainFrame(const wxString& title, const wxPoint& pos, const wxSize& si
 	// Bank panel
 	panel_bank = new wxPanel{notebook, -1, wxPoint(-1, -1), wxSize(-1, -1)};
 	wxSizer *sizer_bank = new wxBoxSizer{wxVERTICAL};
-	bank_view = new wxHtmlWindow{panel_bank};
-	sizer_bank->Add(bank_view, 1, wxEXPAND | wxALL, 10);
+	bank_grid = new BankGrid{panel_bank, [this](const std::string &word, bool enabled)
+	{
+		try { setbankitem(word, enabled); }
+		catch (std::exception &e) { except(e); }
+	}, [this](const std::string &section, bool enabled)
+	{
+		try
+		{
+			curset->deck().bank().section(section, enabled);
+			stattext();
+		}
+		catch (std::exception &e) { except(e); }
+	}};
+	sizer_bank->Add(bank_grid, 1, wxEXPAND | wxALL, 10);
 	panel_bank->SetSizerAndFit(sizer_bank);
 	notebook->AddPage(panel_bank, _("Bank"));
+	
+	// Handler timing panel
+	panel_watch = new wxPanel{notebook, -1, wxPoint(-1, -1), wxSize(-1, -1)};
+	wxSizer *sizer_watch = new wxBoxSizer{wxVERTICAL};
+	watch_log = new wxTextCtrl{panel_watch, wxID_ANY, wxEmptyString, wxDefaultPosition, wxDefaultSize, wxTE_MULTILINE | wxTE_READONLY | wxTE_DONTWRAP};
+	sizer_watch->Add(watch_log, 1, wxEXPAND | wxALL, 10);
+	panel_watch->SetSizerAndFit(sizer_watch);
+	notebook->AddPage(panel_watch, _("Timing"));
+	Watchdog::listen([this](const std::string &line) // Called from the watchdog's thread too
+	{
+		wxThreadEvent *event = new wxThreadEvent{wxEVT_THREAD, id_watchdog};
+		event->SetString(wxString::FromUTF8(line.c_str()));
+		wxQueueEvent(this, event);
+	});
+	heartbeat.SetOwner(this, id_heartbeat);
+	heartbeat.Start(100);
 }
 catch(std::exception &e) { except(e); }
 
-void MainFrame::populate_table_cols(wxDataViewListCtrl *table, const std::vector<coldesc> &columns)
+void MainFrame::populate_table_cols(wxDataViewCtrl *table, const std::vector<coldesc> &columns)
 {
-	table->DeleteAllItems();
 	table->ClearColumns();
 	unsigned int i = 0;
 	for (coldesc col : columns)
 	{
 		if (col.type == coldesc::Type::STRING || col.type == coldesc::Type::FIELD)
 		{
-			table->AppendTextColumn(_(col.title), wxDATAVIEW_CELL_EDITABLE, col.width, wxALIGN_LEFT, wxDATAVIEW_COL_RESIZABLE | wxDATAVIEW_COL_SORTABLE);
+			table->AppendTextColumn(_(col.title), i, wxDATAVIEW_CELL_EDITABLE, col.width, wxALIGN_LEFT, wxDATAVIEW_COL_RESIZABLE | wxDATAVIEW_COL_SORTABLE);
 		}
 		else if (col.type == coldesc::Type::INT)
 		{
@@ -410,7 +987,7 @@ void MainFrame::populate_table_cols(wxDataViewListCtrl *table, const std::vector
 		}
 		else if (col.type == coldesc::Type::STATIC_INT)
 		{
-			table->AppendTextColumn(_(col.title), wxDATAVIEW_CELL_INERT, col.width, wxALIGN_LEFT, wxDATAVIEW_COL_RESIZABLE | wxDATAVIEW_COL_SORTABLE);
+			table->AppendTextColumn(_(col.title), i, wxDATAVIEW_CELL_INERT, col.width, wxALIGN_LEFT, wxDATAVIEW_COL_RESIZABLE | wxDATAVIEW_COL_SORTABLE);
 		}
 		/*else if (col.type == coldesc::Type::DATE)
 		{
@@ -428,7 +1005,7 @@ void MainFrame::populate_table_cols(wxDataViewListCtrl *table, const std::vector
 		}
 		else if (col.type == coldesc::Type::BOOL)
 		{
-			table->AppendToggleColumn(_(col.title), wxDATAVIEW_CELL_ACTIVATABLE, col.width, wxALIGN_CENTER);
+			table->AppendToggleColumn(_(col.title), i, wxDATAVIEW_CELL_ACTIVATABLE, col.width, wxALIGN_CENTER);
 		}
 		i++;
 	}
@@ -438,65 +1015,58 @@ void MainFrame::populate_table_cols(wxDataViewListCtrl *table, const std::vector
  * Converters
  ******************************************************************************/
 
-wxVector<wxVariant> MainFrame::cols2wxvec(std::vector<coldesc> colspec, std::vector<std::string> cols)
+std::pair<Deck *, Set::SetType> MainFrame::tree2deck(wxTreeItemId id)
 {
-	wxVector<wxVariant> row{};
-	for (unsigned int i = 0; i < cols.size(); i++)
-	{
-		wxVariant variant{};
-		coldesc::Type type = colspec[i].type;
-		if (type == coldesc::Type::STRING || type == coldesc::Type::FIELD || type == coldesc::Type::STATIC_INT) variant = wxVariant{wxString::FromUTF8(cols[i].c_str())};
-		//else if (type == coldesc::Type::DATE) variant = wxVariant{wxDateTime{date{cols[i]}.mktime()}};
-		else if (type == coldesc::Type::CHOICE) variant = wxVariant{wxString::FromUTF8(cols[i].c_str())};
-		else if (type == coldesc::Type::INT) variant = wxVariant{util::s2t<int>(cols[i])};
-		else if (type == coldesc::Type::BOOL) variant = wxVariant{cols[i] == "true" ? true : false};
-		else throw std::runtime_error{"Unknown column description type"};
-		row.push_back(variant);
-	}
-	return row;
+	DeckItem *data = itemdata(id);
+	if (! data) return std::make_pair(nullptr, Set::SetType::ALL);
+	return std::make_pair(data->deck, data->type);
 }
 
-std::pair<Deck *, Set::SetType> MainFrame::tree2deck(wxTreeItemId id)
+DeckItem *MainFrame::itemdata(const wxTreeItemId &id) const
 {
-	for (std::pair<std::string, wxTreeItemId> kvpair : deckids) if (kvpair.second == id)
-	{
-		Deck *d = &Deck::get(util::strto(kvpair.first, ":"));
-		std::string ststr = util::strto(kvpair.first, ":");
-		Set::SetType st = Set::str2st((ststr == "") ? "Normal" : ststr);
-		return std::make_pair(d, st);
-	}
-	return std::make_pair(nullptr, Set::SetType::ALL);
+	return id.IsOk() ? static_cast<DeckItem *>(tree_decks->GetItemData(id)) : nullptr;
+}
+
+wxTreeItemId MainFrame::deckitem(Deck *d) // The deck's tree item, filling in its ancestors on the way down if need be
+{
+	std::unordered_map<const Deck *, wxTreeItemId>::iterator iter = deckitems.find(d);
+	if (iter != deckitems.end()) return iter->second;
+	if (! d->parent()) return wxTreeItemId{};
+	fill_deckitem(deckitem(d->parent()));
+	iter = deckitems.find(d);
+	return iter == deckitems.end() ? wxTreeItemId{} : iter->second;
 }
 
 Card *MainFrame::row2card(int row)
 {
-	wxDataViewItem item = browse_cards->RowToItem(row);
-	if (! item.IsOk() || ! card_rows.count(item)) return nullptr;
-	return card_rows[item];
+	return card_model->at(row);
 }
 
-int MainFrame::card2row(Card *card)
+std::vector<Card *> MainFrame::selcards()
 {
-	for (std::pair<wxDataViewItem, Card *> pair : card_rows) if (pair.second == card) return browse_cards->ItemToRow(pair.first);
-	return -1;
+	wxDataViewItemArray items{};
+	browse_cards->GetSelections(items);
+	std::vector<int> rows{};
+	for (const wxDataViewItem &item : items) rows.push_back(card_model->row(item));
+	std::sort(rows.begin(), rows.end());
+	std::vector<Card *> ret{};
+	for (int row : rows) if (Card *card = row2card(row)) ret.push_back(card);
+	return ret;
 }
 
-Deck *MainFrame::row2deck(int row)
+int MainFrame::card2row(Card *card)
 {
-	wxDataViewItem item = browse_decks->RowToItem(row);
-	if (! item.IsOk() || ! deck_rows.count(item)) return nullptr;
-	return deck_rows[item];
+	return card_model->row(card);
 }
 
-int MainFrame::deck2row(Deck *deck)
+Deck *MainFrame::row2deck(int row)
 {
-	for (std::pair<wxDataViewItem, Deck *> pair : deck_rows) if (pair.second == deck) return browse_decks->ItemToRow(pair.first);
-	return -1;
+	return deck_model->at(row);
 }
 
-void MainFrame::table_updaterow(wxDataViewListCtrl *table, int row, const wxVector<wxVariant> &data)
+int MainFrame::deck2row(Deck *deck)
 {
-	for (unsigned int i = 0; i < data.size(); i++) table->SetValue(data[i], row, i);
+	return deck_model->row(deck);
 }
 
 void MainFrame::addcard()
@@ -506,11 +1076,11 @@ void MainFrame::addcard()
 	else deck = &curset->deck();
 	try
 	{
-		Card &card = Card::add(*deck);
-		table_addcard(card);
-		refresh_views(0x6); // Update deck tree, deck table
-		browse_cards->SelectRow(card2row(&card));
-		browse_cards->EnsureVisible(browse_cards->RowToItem(card2row(&card)));
+		Card &card = Card::add(*deck); // modelchanged() adds its row
+		int row = card2row(&card);
+		stattext();
+		browse_cards->Select(card_model->GetItem(row));
+		browse_cards->EnsureVisible(card_model->GetItem(row));
 	}
 	catch (std::runtime_error &e)
 	{
@@ -519,13 +1089,15 @@ void MainFrame::addcard()
 	}
 }
 
-void MainFrame::delcard(int row)
+void MainFrame::delcards(const std::vector<Card *> &cards)
 {
+	std::string curdeck{};
+	if (curset) curdeck = curset->deck().canonical();
 	try
 	{
-		Card::del(*row2card(row));
-		table_delcard(row);
-		refresh_views(0x6); // Update deck tree, deck table
+		Card::del(cards); // modelchanged() takes out their rows
+		if (curset && ! Deck::exists(curdeck)) curset = nullptr; // Its deck may have been implicit
+		stattext();
 	}
 	catch (std::runtime_error &e)
 	{
@@ -534,32 +1106,51 @@ void MainFrame::delcard(int row)
 	}
 }
 
+void MainFrame::editcards(const std::vector<Card *> &cards, const std::function<void(Card &)> &change)
+{
+	std::string curdeck{};
+	if (curset) curdeck = curset->deck().canonical();
+	Card::edit(cards, change);
+	if (curset && ! Deck::exists(curdeck)) curset = nullptr; // Moving may empty an implicit deck
+	stattext(util::t2s(cards.size()) + " cards changed");
+}
+
 /******************************************************************************
  * GUI updaters
  ******************************************************************************/
 
 void MainFrame::showcard()
 {
-	std::string body{};
-	if (! curset) body = "(No deck selected)";
-	else if (curset->size() == 0) body = "(No cards in current set)";
-	//else body = curset->top().display(cardback ? curset->deck().type_back() : curset->type_front());
-	else body = curset->disptop(disp) + html_suff;
-	study_view->SetPage(wxString::FromUTF8((html_pref + body + html_suff).c_str()));
+	if (! curset) study_view->message("(No deck selected)");
+	else if (curset->size() == 0) study_view->message("(No cards in current set)");
+	else
+	{
+		study_view->show(render.face(curset->top(), curset->topdisp(disp)));
+		prefetch();
+	}
 	stattext();
 }
 
+void MainFrame::prefetch() // Render the other sides of this card, and every card that could come next, before they are asked for
+{
+	const std::vector<Set::DispType> sides{Set::DispType::FRONT, Set::DispType::BACK, Set::DispType::HINT};
+	render.clear();
+	Card &top = curset->top();
+	for (Set::DispType side : sides) study_view->prepare(render.face(top, curset->topdisp(side))); // Flipping should only have to draw
+	for (Card *card : curset->upcoming(8)) for (Set::DispType side : sides) for (const Template *tmpl : curset->displays(side)) render.prefetch(*card, *tmpl);
+}
+
 void MainFrame::pagechange()
 {
 	int page = notebook->GetSelection();
 	switch (page)
 	{
 		case 0: // Decks
-			populate_decktree();
 			break;
 		case 1: // Deck
 			if (! curset) deck_name->SetLabel(_("(No deck selected)"));
 			else deck_name->SetLabel(_(curset->canonical()));
+			populate_forecast();
 			break;
 		case 2: // Study
 			disp = Set::DispType::FRONT;
@@ -573,6 +1164,8 @@ void MainFrame::pagechange()
 		case 5: // Bank
 			refresh_views(0x8);
 			break;
+		case 6: // Timing
+			break;
 	}
 	stattext();
 }
@@ -593,122 +1186,208 @@ void MainFrame::stattext(const std::string &text)
 	}
 }
 
-void MainFrame::debug_tablecheck()
+void MainFrame::populate_decktree() // Start over from the top level; deeper items are added as they are expanded
 {
-	for (const std::pair<wxDataViewItem, Card *> &pair : card_rows)
+	tree_decks->DeleteAllItems();
+	deckitems.clear();
+	deckitems[&Deck::root] = tree_decks->AddRoot(_(""), -1, -1, new DeckItem{&Deck::root, Set::SetType::NORMAL, false});
+	fill_deckitem(deckitems[&Deck::root]);
+}
+
+void MainFrame::fill_deckitem(const wxTreeItemId &item) // Add the sets and subdecks under a deck's item
+{
+	DeckItem *data = itemdata(item);
+	if (! data || data->filled) return;
+	data->filled = true;
+	for (Set::SetType st : data->deck->settypes())
 	{
-		wxVariant var{};
-		browse_cards->GetValue(var, browse_cards->ItemToRow(pair.first), 1);
-		std::string expr = wx2utf8(var.GetString());
-		//std::cerr << expr << " - " << pair.second->field("Expression") << "\n";
-		if (expr != pair.second->field("Expression"))
-		{
-			std::cerr << "Card mapping mismatch:  " << expr << " vs " << pair.second->field("Expression") << "\n";
-			throw std::runtime_error{"Card table continuity error"};
-		}
+		DeckItem *set = new DeckItem{data->deck, st, true};
+		tree_decks->SetItemTextColour(tree_decks->AppendItem(item, set->label(), -1, -1, set), wxColor("BLUE"));
 	}
-	for (const std::pair<wxDataViewItem, Deck *> &pair : deck_rows)
+	std::vector<Deck *> temp{};
+	for (Deck *child : data->deck->children()) temp.push_back(child);
+	std::sort(temp.begin(), temp.end(), [](Deck *a, Deck *b) { return a->name() < b->name(); });
+	for (Deck *child : temp) insert_deckitem(item, tree_decks->GetChildrenCount(item, false), child);
+}
+
+wxTreeItemId MainFrame::insert_deckitem(const wxTreeItemId &parent, std::size_t pos, Deck *d)
+{
+	DeckItem *data = new DeckItem{d, Set::SetType::NORMAL, false};
+	wxTreeItemId ret = tree_decks->InsertItem(parent, pos, data->label(), -1, -1, data);
+	tree_decks->SetItemHasChildren(ret); // Every deck has sets to show
+	deckitems[d] = ret;
+	return ret;
+}
+
+wxTreeItemId MainFrame::add_deckitem(Deck *d) // Put a new or moved deck in its place under its parent, if the parent's children are in the tree
+{
+	std::unordered_map<const Deck *, wxTreeItemId>::iterator parent = deckitems.find(d->parent());
+	if (parent == deckitems.end() || ! itemdata(parent->second)->filled) return wxTreeItemId{};
+	std::size_t pos = 0;
+	wxTreeItemIdValue cookie;
+	for (wxTreeItemId child = tree_decks->GetFirstChild(parent->second, cookie); child.IsOk(); child = tree_decks->GetNextChild(parent->second, cookie), pos++)
 	{
-		wxVariant var{};
-		browse_decks->GetValue(var, browse_decks->ItemToRow(pair.first), 0);
-		std::string name = wx2utf8(var.GetString());
-		//std::cerr << name << " - " << pair.second->canonical() << "\n";
-		if (name != pair.second->canonical())
-		{
-			std::cerr << "Deck mapping mismatch:  " << name << " vs " << pair.second->canonical() << "\n";
-			throw std::runtime_error{"Deck table continuity error"};
-		}
+		DeckItem *data = itemdata(child);
+		if (! data->set && ! (data->deck->name() < d->name())) break; // Sets first, then decks by name
 	}
+	return insert_deckitem(parent->second, pos, d);
 }
 
-void MainFrame::populate_decktree(Deck *d)
+void MainFrame::del_deckitem(const wxTreeItemId &item) // Delete an item and forget the decks under it, which may already be gone
 {
-	if (d == &Deck::root)
+	std::vector<wxTreeItemId> todo{item};
+	while (! todo.empty())
 	{
-		tree_decks->DeleteAllItems();
-		deckids.clear();
-		deckids[""] = tree_decks->AddRoot(_(""));
+		wxTreeItemId cur = todo.back();
+		todo.pop_back();
+		DeckItem *data = itemdata(cur);
+		if (! data->set) deckitems.erase(data->deck);
+		wxTreeItemIdValue cookie;
+		for (wxTreeItemId child = tree_decks->GetFirstChild(cur, cookie); child.IsOk(); child = tree_decks->GetNextChild(cur, cookie)) todo.push_back(child);
 	}
-	for (Set::SetType st : Set::settypes())
+	tree_decks->Delete(item);
+}
+
+void MainFrame::populate_cardtable(std::string filter) // Nonempty filters are matched in the background, and the rows arrive through card_found()
+{
+	int gen = ++searchgen;
+	if (searcher.joinable()) searcher.join(); // Quick, since the old search sees the new generation and stops
+	if (filter.empty())
 	{
-		deckids[d->canonical() + ":" + Set::st2str(st)] = tree_decks->AppendItem(deckids[d->canonical()], Set::st2str(st) + " (" + util::t2s<int>(d->set(st).size()) + ")");
-		tree_decks->SetItemTextColour(deckids[d->canonical() + ":" + Set::st2str(st)], wxColor("BLUE"));
+		card_model->reset(Card::search(filter));
+		return;
 	}
-	std::vector<Deck *> temp{};
-	for (Deck *child : d->children()) temp.push_back(child);
-	std::sort(temp.begin(), temp.end(), [](Deck *a, Deck *b) { return a->name() < b->name(); });
-	for (Deck *child : temp)
+	card_model->reset({});
+	searcher = std::thread{[this, gen, filter]()
 	{
-		deckids[child->canonical()] = tree_decks->AppendItem(deckids[d->canonical()], child->name() + " (" + util::t2s<int>(child->set(Set::SetType::NORMAL).size()) + ")");
-		populate_decktree(child);
-	}
+		std::function<bool()> stale = [this, gen]() { return searchgen != gen; };
+		std::vector<int> ids = Card::index().ids(filter, stale);
+		std::size_t batch = 64; // About a screenful, so the first rows show up immediately
+		for (std::size_t start = 0; start < ids.size() && ! stale(); start += batch, batch = 1024)
+		{
+			wxThreadEvent *event = new wxThreadEvent{wxEVT_THREAD, id_search_results};
+			event->SetInt(gen);
+			event->SetPayload(std::vector<int>{ids.begin() + start, ids.begin() + std::min(start + batch, ids.size())});
+			wxQueueEvent(this, event);
+		}
+	}};
 }
 
-void MainFrame::populate_cardtable(std::string filter)
+void MainFrame::populate_decktable()
 {
-	browse_cards->DeleteAllItems();
-	card_rows.clear();
-	for (Card &c : Card::cards()) if (c.match(filter)) table_addcard(c);
+	std::vector<Deck *> rows{};
+	for (Deck &d : Deck::decks()) rows.push_back(&d);
+	deck_model->reset(std::move(rows));
 }
 
-void MainFrame::populate_decktable()
+void MainFrame::populate_bankview()
 {
-	browse_decks->DeleteAllItems();
-	deck_rows.clear();
-	for (Deck &d : Deck::decks()) table_adddeck(d);
+	bank_grid->bank(curset ? &curset->deck().bank() : nullptr);
 }
 
-void MainFrame::populate_bankview()
+void MainFrame::populate_forecast()
 {
-	if (curset) bank_view->SetPage(wxString::FromUTF8(curset->deck().bank().htmlview().c_str()));
-	else bank_view->SetPage("<html><body><center>(No deck selected)</center></body></html>");
+	const int steps = 14;
+	forecast_stale = false;
+	if (! curset)
+	{
+		deck_forecast->SetPage("<html><body><center>(No deck selected)</center></body></html>");
+		return;
+	}
+	std::vector<int> hist = Deck::forecast(steps, forecast_reviews->GetValue()).at(&curset->deck());
+	int peak = std::max(1, *std::max_element(hist.begin(), hist.end()));
+	std::stringstream ret{};
+	ret << "<html><body><table cellspacing=2 cellpadding=0 width=100%>";
+	for (int i = 0; i < steps; i++)
+	{
+		ret << "<tr><td width=60>" << (i == 0 ? "Now" : "+" + util::t2s(i)) << "</td><td><table cellspacing=0 cellpadding=0 width=100%><tr>";
+		if (hist[i] > 0) ret << "<td width=" << std::max(1, hist[i] * 100 / peak) << "% bgcolor=#4060c0>&nbsp;</td>";
+		ret << "<td>&nbsp;" << hist[i] << "</td></tr></table></td></tr>";
+	}
+	ret << "</table></body></html>";
+	deck_forecast->SetPage(wxString::FromUTF8(ret.str().c_str()));
 }
 
 void MainFrame::refresh_views(int mode) try
 {
+	Watchdog::Handler watch{"refresh_views", mode};
 	if (mode & 0x1) populate_cardtable();
 	if (mode & 0x2) populate_decktable();
 	if (mode & 0x4) populate_decktree();
 	if (mode & 0x8) populate_bankview();
 	stattext();
-	debug_tablecheck();
 }
 catch (std::runtime_error &e) { except(e); }
 
-int MainFrame::table_addcard(Card &card)
+void MainFrame::modelchanged(const Notify::Changes &changes) try // Patch just the rows and tree items that changed; curset may be stale partway through an action, so callers update the status themselves
 {
-	browse_cards->AppendItem(cols2wxvec(card_columns, card.vectorize(card_columns)));
-	int row = browse_cards->GetItemCount() - 1;
-	card_rows[browse_cards->RowToItem(row)] = &card;
-	return row;
+	card_model->erase(changes.removed);
+	deck_model->erase(changes.gone);
+	for (Card *card : changes.added) if (card2row(card) == -1) table_addcard(*card);
+	for (Card *card : changes.updated) card_model->changed(card);
+	for (Deck *deck : changes.decks)
+	{
+		if (deck2row(deck) == -1) table_adddeck(*deck);
+		else deck_model->changed(deck);
+		for (Card *card : deck->cards()) card_model->changed(card); // Deck column
+	}
+	for (Deck *deck : changes.counts) deck_model->changed(deck);
+	if (changes.all) // Every card's offset moved
+	{
+		browse_cards->Refresh();
+		browse_decks->Refresh();
+	}
+	for (const Deck *deck : changes.gone) if (deckitems.count(deck)) del_deckitem(deckitems[deck]);
+	for (Deck *deck : changes.decks) if (deckitems.count(deck)) del_deckitem(deckitems[deck]); // Renamed or moved decks go back in at their new place
+	for (Deck *deck : changes.decks) if (! deckitems.count(deck)) add_deckitem(deck);
+	for (Deck *deck : changes.counts) relabel(deck);
+	if (! changes.gone.empty()) bank_grid->bank(nullptr); // It may have been showing a deleted deck's bank
+	else if (changes.bank) bank_grid->reload();
+	if (! changes.empty()) forecast_stale = true; // Redrawn once idle, when curset is settled
+}
+catch (std::runtime_error &e) { except(e); }
+
+void MainFrame::relabel(Deck *d) // Update the set sizes shown for a deck in the tree
+{
+	std::unordered_map<const Deck *, wxTreeItemId>::iterator iter = deckitems.find(d);
+	if (iter == deckitems.end()) return;
+	DeckItem *data = itemdata(iter->second);
+	if (d != &Deck::root) tree_decks->SetItemText(iter->second, data->label());
+	if (! data->filled) return;
+	wxTreeItemIdValue cookie;
+	for (wxTreeItemId child = tree_decks->GetFirstChild(iter->second, cookie); child.IsOk() && itemdata(child)->set; child = tree_decks->GetNextChild(iter->second, cookie)) tree_decks->SetItemText(child, itemdata(child)->label());
 }
 
-void MainFrame::table_delcard(int row)
+int MainFrame::table_addcard(Card &card)
 {
-	//wxDataViewItem item = browse_cards->RowToItem(row);
-	//std::cerr << ">> " << item.GetID() << "\t" << browse_cards->ItemToRow(item) << "\n";
-	card_rows.erase(browse_cards->RowToItem(row));
-	browse_cards->DeleteItem(row);
-	//std::cerr << ">> " << item.GetID() << "\t" << browse_cards->ItemToRow(item) << "\n";
+	return card_model->append(card);
 }
 
 int MainFrame::table_adddeck(Deck& deck)
 {
-	browse_decks->AppendItem(cols2wxvec(deck_columns, deck.vectorize(deck_columns)));
-	int row = browse_decks->GetItemCount() - 1;
-	deck_rows[browse_decks->RowToItem(row)] = &deck;
-	return row;
+	return deck_model->append(deck);
+}
+
+static void deldecks(Deck &deck) // Children first, since ~Deck() doesn't remove their cards from the database
+{
+	for (Deck *child : deck.children()) deldecks(*child);
+	Deck::del(deck);
+}
+
+void MainFrame::editcard(Card &card, const Column<Card> &col, const wxVariant &value) // Apply an edit made in the card table
+{
+	std::string curdeck{};
+	if (curset) curdeck = curset->deck().canonical();
+	col.set(card, value);
+	if (curset && ! Deck::exists(curdeck)) curset = nullptr;
 }
 
-void MainFrame::table_deldeck(int row) // Recursively deletes the deck, child deck entries and cards as well
+void MainFrame::editdeck(Deck &deck, const Column<Deck> &col, const wxVariant &value) // Apply an edit made in the deck table
 {
-	wxVariant val{};
-	browse_decks->GetValue(val, row, 0);
-	for (Card *c : row2deck(row)->cards()) table_delcard(card2row(c));
-	for (Deck *child : row2deck(row)->children()) table_deldeck(deck2row(child));
-	Deck::del(*row2deck(row));
-	deck_rows.erase(browse_decks->RowToItem(row));
-	browse_decks->DeleteItem(row);
+	Deck *curdeck = curset ? &curset->deck() : nullptr;
+	Set::SetType curtype = curset ? curset->type() : Set::SetType::NORMAL;
+	col.set(deck, value);
+	if (curdeck && ! curdeck->hasset(curtype)) curset = &curdeck->set(Set::SetType::NORMAL); // Moving may drop inherited user-defined sets
 }
 
 /******************************************************************************
@@ -717,34 +1396,65 @@ void MainFrame::table_deldeck(int row) // Recursively deletes the deck, child de
 
 void MainFrame::quit(wxCommandEvent& event) try
 {
+	Watchdog::Handler watch{"quit"};
 	Close();
 }
 catch(std::exception &e) { except(e); }
 
 void MainFrame::about(wxCommandEvent& event) try
 {
+	Watchdog::Handler watch{"about"};
 	wxMessageBox(_(PROGRAM " " VERSION "\nBy " AUTHOR " " DATE), _("About"), wxOK | wxICON_INFORMATION, this);
 }
 catch(std::exception &e) { except(e); }
 
 void MainFrame::close(wxCloseEvent &event) try
 {
+	Watchdog::Handler watch{"close"};
+	Notify::close();
+	searchgen++;
+	if (searcher.joinable()) searcher.join();
+	Deck::invalidate();
+	heartbeat.Stop();
+	Watchdog::stop(); // Before the frame goes, since its listener posts to it
 	backend::cleanup();
 	wxExit();
 }
 catch(std::exception &e) { except(e); }
 
+void MainFrame::idle(wxIdleEvent &event) try
+{
+	Watchdog::Handler watch{"idle"};
+	if (forecast_stale && notebook->GetSelection() == 1) populate_forecast();
+	Deck::speculate(); // Get the next step's sets ready so advancing is instant; the heartbeat timer keeps idle events coming until the model has been quiet long enough
+}
+catch(std::exception &e) { except(e); }
+
+void MainFrame::heartbeat_ticked(wxTimerEvent &event) // Not timed, like watchdog_logged(), since they belong to the watchdog
+{
+	Watchdog::beat();
+}
+
+void MainFrame::watchdog_logged(wxThreadEvent &event)
+{
+	watch_log->AppendText(event.GetString() + "\n");
+}
+
 void MainFrame::refresh(wxCommandEvent &event) try
 {
+	Watchdog::Handler watch{"refresh"};
 	refresh_views();
 }
 catch(std::exception &e) { except(e); }
 
 void MainFrame::switch_deck(wxTreeEvent& event) try
 {
+	Watchdog::Handler watch{"switch_deck"};
 	std::pair<Deck *, Set::SetType> pair = tree2deck(tree_decks->GetSelection());
+	if (! pair.first) return; // The selected item was deleted
 	curset = &pair.first->set(pair.second);
-	refresh_views(0x3);
+	if (notebook->GetSelection() == 1) populate_forecast(); // Otherwise pagechange() fills it in when the page is shown
+	stattext();
 }
 catch(std::exception &e)
 {
@@ -752,8 +1462,16 @@ catch(std::exception &e)
 	event.Veto();
 }
 
+void MainFrame::expand_deck(wxTreeEvent &event) try
+{
+	Watchdog::Handler watch{"expand_deck"};
+	fill_deckitem(event.GetItem());
+}
+catch(std::exception &e) { except(e); }
+
 void MainFrame::activate_deck(wxTreeEvent& event) try
 {
+	Watchdog::Handler watch{"activate_deck"};
 	notebook->ChangeSelection(2);
 	pagechange();
 }
@@ -761,95 +1479,149 @@ catch(std::exception &e) { except(e); }
 
 void MainFrame::page_changed(wxNotebookEvent &event) try
 {
+	Watchdog::Handler watch{"page_changed"};
 	pagechange();
 }
 catch(std::exception &e) { except(e); }
 
 void MainFrame::offset_advanced(wxCommandEvent &event) try
 {
+	Watchdog::Handler watch{"offset_advanced"};
 	Deck::step(1);
-	refresh_views();
+	stattext();
 }
 catch(std::exception &e) { except(e); }
 
 void MainFrame::offset_reversed(wxCommandEvent &event) try
 {
+	Watchdog::Handler watch{"offset_reversed"};
 	Deck::step(-1);
-	refresh_views();
+	stattext();
+}
+catch(std::exception &e) { except(e); }
+
+void MainFrame::forecast_toggled(wxCommandEvent &event) try
+{
+	Watchdog::Handler watch{"forecast_toggled"};
+	populate_forecast();
 }
 catch(std::exception &e) { except(e); }
 
 void MainFrame::card_added(wxCommandEvent &event) try
 {
+	Watchdog::Handler watch{"card_added"};
 	addcard();
 }
 catch(std::exception &e) { except(e); }
 
 void MainFrame::card_deleted(wxCommandEvent &event) try
 {
-	std::string curdeck{};
-	if (curset) curdeck = curset->deck().canonical();
-	int row = browse_cards->GetSelectedRow();
-	if (row == wxNOT_FOUND) return;
-	delcard(row);
-	if (curset && ! Deck::exists(curdeck))
-	{
-		curset = nullptr;
-		stattext();
-	}
+	Watchdog::Handler watch{"card_deleted"};
+	std::vector<Card *> cards = selcards();
+	if (cards.empty()) return;
+	delcards(cards);
 }
 catch(std::exception &e) { except(e); }
 
 void MainFrame::card_searched(wxCommandEvent &event) try
 {
+	Watchdog::Handler watch{"card_searched"};
 	populate_cardtable(wx2utf8(event.GetString()));
 }
 catch(std::exception &e) { except(e); }
 
+void MainFrame::card_found(wxThreadEvent &event) try
+{
+	Watchdog::Handler watch{"card_found"};
+	if (event.GetInt() != searchgen) return; // The table has been repopulated since this search started
+	for (int id : event.GetPayload<std::vector<int>>()) if (Card *card = Card::index().card(id)) if (card2row(card) == -1) table_addcard(*card); // Cards added since the search began already have rows
+}
+catch(std::exception &e) { except(e); }
+
 void MainFrame::card_edited(wxDataViewEvent &event) try
 {
-	std::string curdeck{};
+	Watchdog::Handler watch{"card_edited"};
 	assert(notebook->GetSelection() == 3);
-	if (curset) curdeck = curset->deck().canonical();
-	int row = browse_cards->GetSelectedRow();
-	if (row == wxNOT_FOUND) return;
-	Deck *deck;
-	int offset;
-	int delay;
-	Card::Status status;
-	for (unsigned int col = 0; col < card_columns.size(); col++)
-	{
-		wxVariant variant{};
-		browse_cards->GetValue(variant, row, col);
-		std::string value = wx2utf8(variant.GetString());
-		std::string field = card_columns[col].title;
-		if (field == "Deck") deck = &Deck::get(value);
-		else if (field == "Status") status = Card::str2stat(value);
-		else if (field == "Offset") offset = variant.GetInteger(); //nextdue = date{variant.GetDateTime().GetTicks()};
-		else if (field == "Interval") delay = variant.GetInteger();
-		else if (card_columns[col].type == coldesc::Type::FIELD) row2card(row)->field(field, value);
-	}
-	row2card(row)->edit(*deck, offset, delay, status);
-	if (curset && ! Deck::exists(curdeck)) curset = nullptr;
-	refresh_views(0x6); // Update deck tree and table
-	
+	stattext(); // modelchanged() has updated the rows
 }
-catch(std::exception &e)
+catch(std::exception &e) { except(e); }
+
+void MainFrame::card_menu(wxDataViewEvent &event) try
 {
-	err(e.what());
-	event.Veto();
+	Watchdog::Handler watch{"card_menu"};
+	if (! browse_cards->HasSelection()) return;
+	wxMenu menu{};
+	menu.Append(id_cards_move, _("Move to deck..."));
+	menu.Append(id_cards_interval, _("Set interval..."));
+	menu.AppendSeparator();
+	menu.Append(id_cards_suspend, _("Suspend"));
+	menu.Append(id_cards_resume, _("Resume"));
+	menu.Append(id_cards_reset, _("Reset"));
+	menu.AppendSeparator();
+	menu.Append(id_card_del, _("Delete"));
+	PopupMenu(&menu);
+}
+catch(std::exception &e) { except(e); }
+
+void MainFrame::cards_edited(wxCommandEvent &event) try // Apply an action from the context menu to every selected card
+{
+	Watchdog::Handler watch{"cards_edited"};
+	std::vector<Card *> cards = selcards();
+	if (cards.empty()) return;
+	switch (event.GetId())
+	{
+		case id_cards_move:
+		{
+			wxTextEntryDialog dialog{this, _("Deck to move the selected cards to:"), _("Move cards"), wxString::FromUTF8(cards[0]->deck()->canonical().c_str())};
+			if (dialog.ShowModal() != wxID_OK) return;
+			Deck &deck = Deck::get(wx2utf8(dialog.GetValue()));
+			editcards(cards, [&deck](Card &card) { card.edit(deck, card.offset(), card.delay(), card.status()); });
+			break;
+		}
+		case id_cards_interval:
+		{
+			wxTextEntryDialog dialog{this, _("Interval for the selected cards:"), _("Set interval"), wxString::FromUTF8(util::t2s(cards[0]->delay()).c_str())};
+			if (dialog.ShowModal() != wxID_OK) return;
+			long delay = 0;
+			if (! dialog.GetValue().ToLong(&delay) || delay < 0 || delay > Card::maxdelay() * 2) throw std::runtime_error{"Interval must be a number from 0 to " + util::t2s(Card::maxdelay() * 2)};
+			editcards(cards, [delay](Card &card) { card.edit(*card.deck(), card.offset(), delay, card.status()); });
+			break;
+		}
+		case id_cards_suspend:
+			editcards(cards, [](Card &card) { card.edit(*card.deck(), card.offset(), card.delay(), Card::Status::SUSP); });
+			break;
+		case id_cards_resume:
+			editcards(cards, [](Card &card) { card.edit(*card.deck(), card.offset(), card.delay(), Card::Status::OK); });
+			break;
+		case id_cards_reset:
+			editcards(cards, [](Card &card) { card.update(Card::UpdateType::RESET); card.deck()->build(); }); // Deferred to the end of the batch
+			break;
+	}
+}
+catch(std::exception &e) { except(e); }
+
+void MainFrame::table_sorted(wxDataViewEvent &event) try
+{
+	Watchdog::Handler watch{"table_sorted"};
+	wxDataViewColumn *col = event.GetDataViewColumn();
+	if (! col) return;
+	if (event.GetId() == id_browse_cards) card_model->sort(col->GetModelColumn(), col->IsSortOrderAscending());
+	else deck_model->sort(col->GetModelColumn(), col->IsSortOrderAscending());
 }
+catch(std::exception &e) { except(e); }
 
 void MainFrame::deck_added(wxCommandEvent &event) try
 {
+	Watchdog::Handler watch{"deck_added"};
 	std::string deckname = Deck::freename();
 	Deck &deck = Deck::add(deckname); // TODO Defaults
-	table_adddeck(deck);
+	int row = deck2row(&deck);
 	curset = &deck.set(Set::SetType::NORMAL /*settype*/);
 	// TODO Disabling elements based on parameters?
-	refresh_views(0x4); // Update deck tree and set current deck to the new one
-	browse_decks->SelectRow(deck2row(&deck));
-	browse_decks->EnsureVisible(browse_cards->RowToItem(deck2row(&deck)));
+	tree_decks->SelectItem(deckitem(&deck));
+	stattext();
+	browse_decks->Select(deck_model->GetItem(row));
+	browse_decks->EnsureVisible(deck_model->GetItem(row));
 }
 catch(std::exception &e)
 {
@@ -859,66 +1631,71 @@ catch(std::exception &e)
 
 void MainFrame::deck_deleted(wxCommandEvent &event) try
 {
+	Watchdog::Handler watch{"deck_deleted"};
 	std::string curdeck{};
 	if (curset) curdeck = curset->deck().canonical();
-	int row = browse_decks->GetSelectedRow();
+	int row = deck_model->row(browse_decks->GetSelection());
 	if (row == wxNOT_FOUND) return;
 	if (curset != nullptr && row2deck(row) == &curset->deck()) curset = nullptr;
-	table_deldeck(row); // This also deletes the deck
+	{
+		Notify::Batch batch{}; // One refresh for the whole subtree and any implicit parents
+		deldecks(*row2deck(row));
+	}
 	if (curset && ! Deck::exists(curdeck)) curset = nullptr;
-	refresh_views(0x5); // Update deck tree and card table
+	stattext();
 }
 catch(std::exception &e)
 {
 	err(e.what());
-	refresh_views(0x5);
+	refresh_views(0x7);
 }
 
-void MainFrame::setbankitem(const std::string word, bool enabled)
+void MainFrame::deck_setsedit(wxCommandEvent &event) try
 {
-	if (enabled) curset->deck().bank().enable(word);
-	else curset->deck().bank().disable(word);
+	Watchdog::Handler watch{"deck_setsedit"};
+	int row = deck_model->row(browse_decks->GetSelection());
+	if (row == wxNOT_FOUND) return;
+	Deck *deck = row2deck(row);
+	if (! deck->explic()) throw std::runtime_error{"Sets can only be defined on explicit decks"};
+	std::string defs{};
+	for (const std::pair<const Set::SetType, std::shared_ptr<const Filter>> &f : deck->ownfilters()) defs += Set::st2str(f.first) + ": " + f.second->expr() + "\n";
+	wxTextEntryDialog dialog{this, _("One set per line, as \"Name: filter\".  Filters test due, avail, bank, status == Leech, offset, interval, norm, incr, decr\nor reset against numbers, and fields with ==, != or ~ (contains) \"text\", combined with and, or, not."), _("Sets for " + deck->canonical()), wxString::FromUTF8(defs.c_str()), wxTextEntryDialogStyle | wxTE_MULTILINE};
+	if (dialog.ShowModal() != wxID_OK) return;
+	std::map<std::string, std::string> parsed{};
+	std::string text = wx2utf8(dialog.GetValue());
+	for (std::string_view line : util::split{text, "\n"})
+	{
+		if (util::trim(line).empty()) continue;
+		std::string_view::size_type sep = line.find(':');
+		if (sep == std::string_view::npos) throw std::runtime_error{"Expected \"Name: filter\" but got \"" + std::string{line} + "\""};
+		parsed[std::string{util::trim(line.substr(0, sep), " \t")}] = line.substr(sep + 1);
+	}
+	Deck *curdeck = curset ? &curset->deck() : nullptr;
+	Set::SetType curtype = curset ? curset->type() : Set::SetType::NORMAL;
+	deck->filters(parsed);
+	if (curdeck && ! curdeck->hasset(curtype)) curset = &curdeck->set(Set::SetType::NORMAL);
+	stattext();
 }
+catch(std::exception &e) { err(e.what()); }
 
-void MainFrame::bankitem_set(wxHtmlLinkEvent &event) try
+void MainFrame::setbankitem(const std::string word, bool enabled)
 {
-	std::string word = wx2utf8(event.GetLinkInfo().GetHref());
-	setbankitem(word, ! curset->deck().bank().enabled(word));
+	if (enabled) curset->deck().bank().enable(word);
+	else curset->deck().bank().disable(word);
+	stattext(); // The bank moves cards between sets in place
 }
-catch(std::exception &e) { except(e); }
 
 void MainFrame::deck_edited(wxDataViewEvent &event) try
 {
+	Watchdog::Handler watch{"deck_edited"};
 	assert(notebook->GetSelection() == 4);
-	Deck *deck = deck_rows[event.GetItem()]; //browse_decks->GetSelectedRow();
-	//assert(row != wxNOT_FOUND);
-	std::string name = "";
-	bool explic = false;
-	Card::Field front = Card::Field::NONE, back = Card::Field::NONE;
-	for (unsigned int col = 0; col < deck_columns.size(); col++)
-	{
-		wxVariant variant{};
-		browse_decks->GetValue(variant, deck2row(deck), col);
-		std::string value = wx2utf8(variant.GetString());
-		std::string field = deck_columns[col].title;
-		if (field == "Name") name = value;
-		else if (field == "Explicit") explic = variant.GetBool();
-		else if (field == "Front") front = Card::str2sit(value);
-		else if (field == "Back") back = Card::str2sit(value);
-	}
-	if (! deck->edit(name, explic)) throw std::runtime_error{"Deck editing failed"}; // TODO This should not be a fatal error; just pop something up
-	// TODO Get selected row
-	refresh_views(0x7);
-	// TODO Restore selected row
-}
-catch(std::exception &e)
-{
-	err(e.what());
-	event.Veto();
+	stattext(); // modelchanged() has updated the rows and tree
 }
+catch(std::exception &e) { except(e); }
 
 void MainFrame::keydown(wxKeyEvent &event) try
 {
+	Watchdog::Handler watch{"keydown"};
 	int page = notebook->GetSelection();
 	int key = event.GetKeyCode();
 	if (page != 2) throw std::runtime_error{"keydown called in wrong tab"};
@@ -979,11 +1756,12 @@ void MainFrame::keydown(wxKeyEvent &event) try
 		case 'E':
 			notebook->ChangeSelection(3);
 			pagechange();
-			browse_cards->SelectRow(card2row(&curcard));
-			browse_cards->EnsureVisible(browse_cards->RowToItem(card2row(&curcard)));
+			if (card2row(&curcard) == -1) populate_cardtable(); // Clear the search if it hides the card
+			browse_cards->Select(card_model->GetItem(card2row(&curcard)));
+			browse_cards->EnsureVisible(card_model->GetItem(card2row(&curcard)));
 			return;
 		case 'D':
-			delcard(card2row(&curcard));
+			delcards({&curcard});
 			return;
 		case 'S':
 			curset->shuffle();
@@ -994,15 +1772,13 @@ void MainFrame::keydown(wxKeyEvent &event) try
 	}
 	disp = Set::DispType::FRONT;
 	curset->update(ut);
-	// TODO Update card and deck tables to reflect updated information
-	//table_updaterow(browse_cards, card2row(&curcard), cols2wxvec(card_columns, curcard.vectorize(card_columns)));
-	//table_updaterow(browse_decks, 0 /* FIXME */, cols2wxvec(deck_columns, curdeck->vectorize(deck_columns));
 	showcard();
 }
 catch(std::exception &e) { except(e); }
 
 void MainFrame::key_view(wxKeyEvent &event) try
 {
+	Watchdog::Handler watch{"key_view"};
 	int key = event.GetKeyCode();
 	switch(key)
 	{
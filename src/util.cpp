@@ -3,82 +3,118 @@
 
 namespace util
 {
-	std::string strto(std::string &str, const std::string &substr)
+	std::string_view strto(std::string_view &str, std::string_view delim)
 	{
-		std::string ret{};
-		while (str.length() >= substr.length())
+		std::string_view::size_type pos = str.find(delim);
+		std::string_view ret = str.substr(0, pos);
+		str = pos == std::string_view::npos ? str.substr(str.size()) : str.substr(pos + delim.size());
+		return ret;
+	}
+
+	std::string_view strto(const std::string &str, std::string_view delim)
+	{
+		return std::string_view{str}.substr(0, str.find(delim));
+	}
+
+	std::string_view trim(std::string_view str, std::string_view chars)
+	{
+		std::string_view::size_type start = str.find_first_not_of(chars);
+		if (start == std::string_view::npos) return str.substr(str.size());
+		return str.substr(start, str.find_last_not_of(chars) - start + 1);
+	}
+
+	const unsigned char utf8_iter::lengths_[256] = {
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x00
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x20
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x80, continuation bytes
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0xA0
+		2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 0xC0
+		3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 0, 0  // 0xE0
+	};
+	
+	bool cjk(uint32_t c)
+	{
+		struct table // One bitmap per 256-codepoint page; pages entirely in or out of range share the first two bitmaps
 		{
-			if (str.substr(0, substr.length()) == substr)
+			std::vector<uint16_t> index;
+			std::vector<std::array<uint64_t, 4>> pages;
+			table() : index{}, pages{{{0, 0, 0, 0}}, {{~0ull, ~0ull, ~0ull, ~0ull}}}
 			{
-				str.erase(0, substr.length());
-				return ret;
+				const std::vector<std::pair<uint32_t, uint32_t>> ranges{{0x4E00, 0xA000}, {0x3400, 0x4DC0}, {0x20000, 0x2A6E0}, {0x2A700, 0x2B740}, {0x2B741, 0x2B820}, {0xF901, 0xFB00}, {0x2E81, 0x2FE0}, {0x3001, 0x3040}, {0x2F801, 0x2FA20}, {0xFE31, 0xFE50}}; // Half-open
+				uint32_t top = 0;
+				for (const std::pair<uint32_t, uint32_t> &r : ranges) top = std::max(top, r.second);
+				index.assign((top + 255) / 256, 0);
+				for (uint32_t page = 0; page < index.size(); page++)
+				{
+					std::array<uint64_t, 4> bits{{0, 0, 0, 0}};
+					for (const std::pair<uint32_t, uint32_t> &r : ranges) for (uint32_t cp = std::max(r.first, page * 256); cp < std::min(r.second, page * 256 + 256); cp++) bits[(cp >> 6) & 3] |= 1ull << (cp & 63);
+					std::vector<std::array<uint64_t, 4>>::iterator found = std::find(pages.begin(), pages.end(), bits);
+					if (found == pages.end()) found = pages.insert(pages.end(), bits);
+					index[page] = found - pages.begin();
+				}
 			}
-			ret += str[0];
-			str.erase(0, 1);
-		}
+		};
+		static const table t{};
+		if ((c >> 8) >= t.index.size()) return false;
+		return (t.pages[t.index[c >> 8]][(c >> 6) & 3] >> (c & 63)) & 1;
+	}
+
+	std::string utf8_encode(uint32_t c)
+	{
+		std::string ret{};
+		if (c < 0x80) ret += static_cast<char>(c);
+		else if (c < 0x800) ret += {static_cast<char>(0xC0 | (c >> 6)), static_cast<char>(0x80 | (c & 0x3F))};
+		else if (c < 0x10000) ret += {static_cast<char>(0xE0 | (c >> 12)), static_cast<char>(0x80 | ((c >> 6) & 0x3F)), static_cast<char>(0x80 | (c & 0x3F))};
+		else ret += {static_cast<char>(0xF0 | (c >> 18)), static_cast<char>(0x80 | ((c >> 12) & 0x3F)), static_cast<char>(0x80 | ((c >> 6) & 0x3F)), static_cast<char>(0x80 | (c & 0x3F))};
 		return ret;
 	}
 
-	std::string strto(const std::string &str, const std::string &substr)
+	std::string_view basename(std::string_view str, std::string_view delim)
 	{
-		std::string nonconst = str;
-		return strto(nonconst, substr);
+		std::string_view::size_type pos = str.rfind(delim);
+		if (pos == std::string_view::npos) return str;
+		return str.substr(pos + delim.size());
 	}
 
-	std::string utf8_popchar(std::string &str)
+	std::string_view dirname(std::string_view str, std::string_view delim)
 	{
-		std::string ret{};
-		if (str.length() == 0) return ret;
-		char c = str[0];
-		unsigned int len = 0;
-		if ((c & 0x80) == 0x0) len = 1;
-		else if ((c & 0xE0) == 0xC0) len = 2;
-		else if ((c & 0xF0) == 0xE0) len = 3;
-		else if ((c & 0xF8) == 0xF0) len = 4;
-		else if ((c & 0xFC) == 0xF8) len = 5;
-		else if ((c & 0xFE) == 0xFC) len = 6;
-		else throw std::runtime_error{"Invalid UTF-8 byte sequence"};
-		ret += c;
-		unsigned int i;
-		for (i = 1; i < len && i < str.length(); i++) ret += str[i];
-		str = str.substr(i);
-		return ret;
+		std::string_view::size_type pos = str.rfind(delim);
+		if (pos == std::string_view::npos) return str.substr(0, 0);
+		return str.substr(0, pos);
 	}
 	
-	int64_t utf8_codepoint(const std::string &str)
+	int fenwick::prefix(unsigned int n) const
 	{
-		int64_t ret = 0;
-		for (unsigned char c : str)
-		{
-			if ((c & 0x80) == 0x0) ret = (ret << 7) | c;
-			else if ((c & 0xC0) == 0x80) ret = (ret << 6) | (c & 0x3F);
-			else if ((c & 0xE0) == 0xC0) ret = (ret << 5) | (c & 0x1F);
-			else if ((c & 0xF0) == 0xE0) ret = (ret << 4) | (c & 0x0F);
-			else if ((c & 0xF8) == 0xF0) ret = (ret << 3) | (c & 0x07);
-			else if ((c & 0xFC) == 0xF8) ret = (ret << 2) | (c & 0x03);
-			else if ((c & 0xFE) == 0xFC) ret = (ret << 1) | (c & 0x01);
-			else throw std::runtime_error{"Invalid UTF-8 byte sequence"};
-		}
+		int ret = 0;
+		for (; n > 0; n -= n & -n) ret += tree_[n];
 		return ret;
 	}
 
-	std::string basename(const std::string &str, const std::string &substr)
+	unsigned int fenwick::find(int target) const
 	{
-		std::string ret{};
-		for (int i = str.length() - 1; i > static_cast<int>(str.length() - substr.length()); i--) ret = str[i] + ret;
-		for (int i = str.length() - substr.length(); i >= 0; i--)
+		if (target < 0 || target >= total()) throw std::runtime_error{"Fenwick tree target out of range"};
+		unsigned int pos = 0;
+		unsigned int step = 1;
+		while (step * 2 < tree_.size()) step *= 2;
+		for (; step > 0; step /= 2)
 		{
-			if (str.substr(i, substr.length()) == substr) break;
-			ret = str[i] + ret;
+			if (pos + step < tree_.size() && tree_[pos + step] <= target)
+			{
+				pos += step;
+				target -= tree_[pos];
+			}
 		}
-		return ret;
+		return pos;
 	}
 
-	std::string dirname(const std::string &str, const std::string &substr)
+	void fenwick::set(unsigned int i, int w)
 	{
-		int i;
-		for (i = str.length() - substr.length(); i > 0; i--) if (str.substr(i, substr.length()) == substr) break;
-		return str.substr(0, i);
+		int diff = w - vals_.at(i);
+		if (diff == 0) return;
+		vals_[i] = w;
+		for (unsigned int n = i + 1; n < tree_.size(); n += n & -n) tree_[n] += diff;
 	}
 	
 	bool file_exists(const std::string &path)
@@ -9,39 +9,201 @@
 #define	UTIL_H
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <exception>
 #include <stdexcept>
 #include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <charconv>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
 #include <sys/stat.h>
 
 namespace util
 {
+	template <typename T> constexpr bool numeric_v = std::is_arithmetic<T>::value && ! std::is_same<T, bool>::value && ! std::is_same<T, char>::value; // Types t2s() and s2t() convert with charconv rather than streams
+
+	class conversion_error : public std::runtime_error // Thrown by s2t() with the reason the text was rejected
+	{
+	private:
+		std::errc code_;
+	public:
+		conversion_error(std::string_view str, std::errc code) : std::runtime_error{"Could not convert \"" + std::string{str} + "\" to a number: " + (code == std::errc::result_out_of_range ? "out of range" : "not a number")}, code_{code} { }
+		std::errc code() const { return code_; } // Either invalid_argument or result_out_of_range
+	};
+
 	template <typename T> std::string t2s(const T t) // Convert type to string
 	{
-		std::stringstream ret{};
-		ret << t;
-		return ret.str();
+		if constexpr (numeric_v<T>)
+		{
+			std::array<char, 32> buf; // Enough for any integer or the shortest round-trip form of a double
+			std::to_chars_result res = std::to_chars(buf.data(), buf.data() + buf.size(), t);
+			return std::string{buf.data(), res.ptr};
+		}
+		else
+		{
+			std::stringstream ret{};
+			ret << t;
+			return ret.str();
+		}
 	}
 
-	template <typename T> T s2t(const std::string &s) // Convert string to type
+	template <typename T> T s2t(std::string_view s) // Convert string to type, ignoring surrounding whitespace
 	{
-		//for (char c : s) if (c != ' ' && c != '\t' && c != '-' && (c < 48 || c > 57)) throw std::runtime_error("String is not an int");
-		std::stringstream ss{};
-		ss << s;
-		T ret;
-		ss >> ret;
-		return ret;
+		if constexpr (numeric_v<T>)
+		{
+			s = s.substr(std::min(s.size(), s.find_first_not_of(" \t\r\n")));
+			s = s.substr(0, s.find_last_not_of(" \t\r\n") + 1);
+			T ret{};
+			std::from_chars_result res = std::from_chars(s.data(), s.data() + s.size(), ret);
+			if (res.ec != std::errc{}) throw conversion_error{s, res.ec};
+			if (res.ptr != s.data() + s.size()) throw conversion_error{s, std::errc::invalid_argument};
+			return ret;
+		}
+		else
+		{
+			std::stringstream ss{};
+			ss << s;
+			T ret;
+			ss >> ret;
+			return ret;
+		}
 	}
 	
-	std::string strto(std::string &str, const std::string &substr); // Remove and return the portion of the string up to the supplied substring.  Like getline(), only without sstreams
-	std::string strto(const std::string &str, const std::string &substr); // Same as above, without eating up the string
-	std::string utf8_popchar(std::string &str); // Remove and return a single UTF-8 character from the front of a string
-	int64_t utf8_codepoint(const std::string &str); // Return the codepoint of the UTF-8 character contained in the string
-	std::string basename(const std::string &str, const std::string &substr = "/"); // Return the part of the string after the last occurrence of the supplied substring
-	std::string dirname(const std::string &str, const std::string &substr = "/"); // Return the part of the string up to the last occurrence of the supplied substring
+	std::string_view strto(std::string_view &str, std::string_view delim); // Remove and return the portion of the view up to the delimiter, or all of it if there is none.  Like getline(), only without sstreams
+	std::string_view strto(const std::string &str, std::string_view delim); // Same as above, without eating up the string
+	std::string_view trim(std::string_view str, std::string_view chars = " \t\r\n"); // Drop leading and trailing characters in the set
+	bool cjk(uint32_t c); // True if the codepoint is a CJK ideograph or related symbol, as looked up in a two-level table
+	std::string utf8_encode(uint32_t c); // Return the UTF-8 encoding of a single codepoint
+	std::string_view basename(std::string_view str, std::string_view delim = "/"); // Return the part of the string after the last occurrence of the delimiter
+	std::string_view dirname(std::string_view str, std::string_view delim = "/"); // Return the part of the string up to the last occurrence of the delimiter
 	bool file_exists(const std::string &path); // Return true if the file exists and false otherwise
 	
+	template <typename F> void parallel_for(std::size_t n, F fn) // Run fn(i) for i in [0, n) on all cores; idle workers take the next index, so uneven tasks balance themselves
+	{
+		unsigned int nthreads = std::max(1u, std::thread::hardware_concurrency());
+		if (nthreads > n) nthreads = n;
+		if (nthreads <= 1)
+		{
+			for (std::size_t i = 0; i < n; i++) fn(i);
+			return;
+		}
+		std::atomic<std::size_t> next{0};
+		std::vector<std::exception_ptr> errors(nthreads);
+		std::vector<std::thread> workers{};
+		for (unsigned int t = 0; t < nthreads; t++) workers.emplace_back([&, t]()
+		{
+			try { for (std::size_t i = next++; i < n; i = next++) fn(i); }
+			catch (...) { errors[t] = std::current_exception(); next = n; }
+		});
+		for (std::thread &worker : workers) worker.join();
+		for (std::exception_ptr &e : errors) if (e) std::rethrow_exception(e);
+	}
+	
+	class split // The segments of a string between delimiters, as views into it: for (std::string_view seg : util::split{path, "/"})
+	{
+	private:
+		std::string_view str_, delim_;
+	public:
+		class iterator
+		{
+		private:
+			std::string_view rest_, delim_, cur_;
+			bool done_;
+		public:
+			iterator() : rest_{}, delim_{}, cur_{}, done_{true} { }
+			iterator(std::string_view str, std::string_view delim) : rest_{str}, delim_{delim}, cur_{}, done_{false} { ++*this; }
+			std::string_view operator *() const { return cur_; }
+			const std::string_view *operator ->() const { return &cur_; }
+			iterator &operator ++()
+			{
+				if (rest_.data() == nullptr) done_ = true; // The last segment has already been returned
+				else
+				{
+					std::string_view::size_type pos = rest_.find(delim_);
+					cur_ = rest_.substr(0, pos);
+					rest_ = pos == std::string_view::npos ? std::string_view{} : rest_.substr(pos + delim_.size());
+				}
+				return *this;
+			}
+			bool operator ==(const iterator &other) const { return done_ == other.done_ && (done_ || rest_.data() == other.rest_.data()); }
+			bool operator !=(const iterator &other) const { return ! (*this == other); }
+		};
+		split(std::string_view str, std::string_view delim) : str_{str}, delim_{delim} { if (delim_.empty()) throw std::runtime_error{"Empty delimiter"}; }
+		iterator begin() const { return str_.empty() ? end() : iterator{str_, delim_}; }
+		iterator end() const { return iterator{}; }
+	};
+	
+	class utf8_iter // Decodes UTF-8 in place from a byte range, without copying
+	{
+	private:
+		static const unsigned char lengths_[256]; // Sequence length by lead byte, or 0 if it can't start a character
+		const char *pos_, *end_;
+	public:
+		utf8_iter(const char *begin, const char *end) : pos_{begin}, end_{end} { }
+		utf8_iter(std::string_view str) : utf8_iter{str.data(), str.data() + str.size()} { }
+		bool done() const { return pos_ >= end_; }
+		const char *pos() const { return pos_; }
+		std::size_t skip_ascii() // Advance past a run of ASCII, eight bytes at a time where possible
+		{
+			const char *start = pos_;
+			uint64_t word;
+			while (end_ - pos_ >= 8)
+			{
+				std::memcpy(&word, pos_, 8);
+				if (word & 0x8080808080808080ull) break;
+				pos_ += 8;
+			}
+			while (pos_ < end_ && ! (*pos_ & 0x80)) pos_++;
+			return pos_ - start;
+		}
+		uint32_t next() // Decode one character and advance past it
+		{
+			unsigned char c = *pos_;
+			unsigned int len = lengths_[c];
+			if (len == 1) { pos_++; return c; }
+			if (len == 0) throw std::runtime_error{"Invalid UTF-8 byte sequence"};
+			uint32_t ret = c & (0x7F >> len);
+			const char *end = (end_ - pos_ < static_cast<std::ptrdiff_t>(len)) ? end_ : pos_ + len; // Tolerate a truncated final character
+			for (pos_++; pos_ < end; pos_++) ret = (ret << 6) | (*pos_ & 0x3F);
+			return ret;
+		}
+		std::string nextstr() { const char *start = pos_; next(); return std::string{start, pos_}; } // The next character as a string
+	};
+	
+	class cpset // Set of codepoints as a dense bitmap, grown to fit the largest member
+	{
+	private:
+		std::vector<uint64_t> bits_;
+	public:
+		cpset() : bits_{} { }
+		bool count(uint32_t c) const { return (c >> 6) < bits_.size() && ((bits_[c >> 6] >> (c & 63)) & 1); }
+		void insert(uint32_t c) { if ((c >> 6) >= bits_.size()) bits_.resize((c >> 6) + 1, 0); bits_[c >> 6] |= 1ull << (c & 63); }
+		void erase(uint32_t c) { if ((c >> 6) < bits_.size()) bits_[c >> 6] &= ~(1ull << (c & 63)); }
+		bool empty() const { return std::all_of(bits_.begin(), bits_.end(), [](uint64_t w) { return w == 0; }); }
+	};
+	
+	class fenwick // Binary indexed tree over non-negative integer weights, for O(log n) weighted sampling
+	{
+	private:
+		std::vector<int> tree_;
+		std::vector<int> vals_;
+	public:
+		fenwick(unsigned int n = 0) : tree_(n + 1, 0), vals_(n, 0) { }
+		unsigned int size() const { return vals_.size(); }
+		int get(unsigned int i) const { return vals_.at(i); }
+		int total() const { return prefix(vals_.size()); }
+		int prefix(unsigned int n) const; // Sum of the first n weights
+		unsigned int find(int target) const; // Index of the slot containing the target'th unit of weight
+		void resize(unsigned int n) { tree_.assign(n + 1, 0); vals_.assign(n, 0); }
+		void set(unsigned int i, int w);
+	};
+	
 	struct enum_hash
 	{
 		template <typename T> inline typename std::enable_if<std::is_enum<T>::value, std::size_t>::type operator ()(T const value) const